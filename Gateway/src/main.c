@@ -41,6 +41,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
@@ -57,6 +58,11 @@
 #define MEAS_COMPLETE_BUFF_LEN  (MEAS_DIST_RES_BUFF_LEN + MEAS_HEADER_BUFF_LEN)
 
 #define LIGHTRANGER9_OBJECT_MAP_SIZE    (64U)
+#define LIGHTRANGER9_PARTIAL_MAX_ZONES  (16U)
+
+// Broadcast payload types, should be the same as the broadcaster's
+#define BT_MSG_TYPE_MEASUREMENT     0x01
+#define BT_MSG_TYPE_PARTIAL         0x02
 
 // Cradentials of the Wi-FI network the user wants to connect to
 #define WIFI_SSID           "your_ssid"
@@ -87,7 +93,7 @@
  * @brief Line formatter for json
  * 
  */
-const char format_str[] = "{\"resno\":%d,\"temp\":%d,\"valres\":%d,\"ambli\":%d,\"phocnt\":%d,\"refcnt\":%d,\"syst\":%.2f,\"res\":%s}";
+const char format_str[] = "{\"resno\":%d,\"temp\":%d,\"valres\":%d,\"ambli\":%d,\"phocnt\":%d,\"refcnt\":%d,\"syst\":%.2f,\"zones\":%d,\"kiter\":%d,\"res\":%s}";
 
 /**
  * @brief Distance measurements struct
@@ -105,7 +111,8 @@ typedef struct __attribute__((__packed__)) bt_data_header_type {
 
 /** Structure holding the measurements of the LightRanger9 (TMF8828) sensor .
  * Note: This struct declaration should be the same as the one used by the
- * broadcaster (check lightranger9.h)
+ * broadcaster (check lightranger9.h). Over the air only the first `zones`
+ * entries of obj1 and obj2 are sent, obj2 directly following them.
  */
 typedef struct __attribute__((__packed__)) lightranger9_btdata_type {
     uint8_t result_number;
@@ -115,13 +122,31 @@ typedef struct __attribute__((__packed__)) lightranger9_btdata_type {
     uint32_t photon_count;
     uint32_t reference_count;
     float sys_tick_sec;
+    uint8_t zones;
+    uint16_t kilo_iterations;
     lightranger9_meas_result_t obj1[LIGHTRANGER9_OBJECT_MAP_SIZE];
     lightranger9_meas_result_t obj2[LIGHTRANGER9_OBJECT_MAP_SIZE];
 } lightranger9_btdata_t;
 
+/** The zones of a single sub-capture, sent instead of complete measurements
+ * when the broadcaster streams partial frames. obj1[i] and obj2[i] belong
+ * to zone zone[i].
+ * Note: This struct declaration should be the same as the one used by the
+ * broadcaster (check lightranger9.h)
+ */
+typedef struct __attribute__((__packed__)) lightranger9_partial_type {
+    uint8_t result_number;
+    uint8_t sub_capture;
+    uint8_t zones;
+    uint8_t count;
+    uint8_t zone[LIGHTRANGER9_PARTIAL_MAX_ZONES];
+    lightranger9_meas_result_t obj1[LIGHTRANGER9_PARTIAL_MAX_ZONES];
+    lightranger9_meas_result_t obj2[LIGHTRANGER9_PARTIAL_MAX_ZONES];
+} lightranger9_partial_t;
+
 static bt_data_header_t header;
 static bt_data_header_t prev_header;
-static uint8_t buffer[sizeof(lightranger9_btdata_t)];
+static uint8_t buffer[1 + sizeof(lightranger9_btdata_t)];
 lightranger9_btdata_t gMeasurement = {0};
 
 /**
@@ -219,6 +244,26 @@ static bool adv_check_name(struct bt_data *data, void *name_found);
 static bool adv_data_found(struct bt_data *data, void *user_data);
 
 
+/**
+ * @brief Unpacks a reassembled broadcast payload, the object maps
+ * are cut down to the zones of the broadcaster's zone mode.
+ * 
+ * @param buf   reassembled payload.
+ * @param meas  measurements struct.
+ */
+static void unpack_measurement(const uint8_t *buf, lightranger9_btdata_t *meas);
+
+
+/**
+ * @brief Updates the zones of a sub-capture in the measurement,
+ * the rest of the maps and the header keep their last values.
+ * 
+ * @param buf   reassembled payload.
+ * @param meas  measurements struct.
+ */
+static void apply_partial(const uint8_t *buf, lightranger9_btdata_t *meas);
+
+
 /**
  * @brief Used to convert the distance measurement part
  * to a JSON string to be used in mqttMeasurementToJson()
@@ -295,6 +340,42 @@ static bool adv_check_name(struct bt_data *data, void *name_found)
 }
 
 
+static void unpack_measurement(const uint8_t *buf, lightranger9_btdata_t *meas)
+{
+    size_t header_len = offsetof(lightranger9_btdata_t, obj1);
+    size_t map_len;
+
+    memcpy(meas, buf, header_len);
+    if (meas->zones > LIGHTRANGER9_OBJECT_MAP_SIZE) {
+        meas->zones = LIGHTRANGER9_OBJECT_MAP_SIZE;
+    }
+    map_len = meas->zones * sizeof(lightranger9_meas_result_t);
+
+    memcpy(meas->obj1, buf + header_len, map_len);
+    memcpy(meas->obj2, buf + header_len + map_len, map_len);
+}
+
+
+static void apply_partial(const uint8_t *buf, lightranger9_btdata_t *meas)
+{
+    lightranger9_partial_t partial;
+    uint8_t i;
+
+    memcpy(&partial, buf, sizeof(partial));
+    meas->result_number = partial.result_number;
+    meas->zones = MIN(partial.zones, LIGHTRANGER9_OBJECT_MAP_SIZE);
+
+    for (i = 0; i < MIN(partial.count, LIGHTRANGER9_PARTIAL_MAX_ZONES); i++) {
+        if (partial.zone[i] < LIGHTRANGER9_OBJECT_MAP_SIZE) {
+            meas->obj1[partial.zone[i]] = partial.obj1[i];
+            meas->obj2[partial.zone[i]] = partial.obj2[i];
+        } else {
+            // do nothing
+        }
+    }
+}
+
+
 static bool adv_data_found(struct bt_data *data, void *user_data)
 {
     static uint8_t cnt = 0;
@@ -335,18 +416,29 @@ static bool adv_data_found(struct bt_data *data, void *user_data)
                        data->data_len - sizeof(header));
                 cnt++;
                 memcpy(&prev_header, &header, sizeof(header));
-
-                if (cnt == header.parts_total) {
-                    memcpy(&gMeasurement, buffer, sizeof(gMeasurement));
-                    gMeasReceived = true;
-                    cnt = 0;
-                    memset(&prev_header, 0, sizeof(prev_header));
-                    memset(&header, 0, sizeof(header));
-                }
             } else {
                 // do nothing
             }
         }
+
+        /**
+         * 3x3 and 4x4 measurements can fit in a single part
+         */
+        if ((cnt != 0) && (cnt == header.parts_total)) {
+            if (buffer[0] == BT_MSG_TYPE_PARTIAL) {
+                apply_partial(&buffer[1], &gMeasurement);
+            } else {
+                unpack_measurement(&buffer[1], &gMeasurement);
+            }
+            gMeasReceived = true;
+            /**
+             * prev_header is kept, the broadcaster keeps advertising
+             * the last part and it must not be taken again
+             */
+            cnt = 0;
+        } else {
+            // do nothing
+        }
     } else {
         //do nothing
     }
@@ -407,17 +499,26 @@ static bool mqttMeasurementToJsonHelper(lightranger9_btdata_t *meas, char *json,
     uint16_t current_len = 0;
     bool ret;
 
+    /**
+     * Without zones there are no maps to send, and the loop
+     * below would leave the arrays unterminated
+     */
+    if (meas->zones == 0) {
+        printk("Measurement without zones, not published\n");
+        return false;
+    }
+
     /**
      * Convert measurements to json array
      */
     current_len = snprintk(json,
                            max_len - current_len,
                            "{\"map1\":[");
-    for (cnt = 0; cnt < LIGHTRANGER9_OBJECT_MAP_SIZE * 2; cnt++) {
+    for (cnt = 0; cnt < meas->zones * 2; cnt++) {
         /**
          * Measurements from 1st Object Map
          */
-        if (cnt < (LIGHTRANGER9_OBJECT_MAP_SIZE)) {
+        if (cnt < meas->zones) {
             current_len += snprintk(json + current_len,
                                     max_len - current_len,
                                     "%d,",
@@ -430,7 +531,7 @@ static bool mqttMeasurementToJsonHelper(lightranger9_btdata_t *meas, char *json,
          * Terminate first array
          * Start 2nd array
          */
-        if (cnt == LIGHTRANGER9_OBJECT_MAP_SIZE) {
+        if (cnt == meas->zones) {
             current_len --;
             current_len += snprintk(json + current_len,
                                     max_len - current_len,
@@ -442,11 +543,11 @@ static bool mqttMeasurementToJsonHelper(lightranger9_btdata_t *meas, char *json,
         /**
          * Measurements from 2nd Object Map
          */
-        if (cnt >= LIGHTRANGER9_OBJECT_MAP_SIZE) {
+        if (cnt >= meas->zones) {
             current_len += snprintk(json + current_len,
                                     max_len - current_len,
                                     "%d,",
-                                    meas->obj2[cnt - LIGHTRANGER9_OBJECT_MAP_SIZE].distance_mm);
+                                    meas->obj2[cnt - meas->zones].distance_mm);
         } else {
             // do nothing
         }
@@ -495,6 +596,8 @@ static bool mqttMeasurementToJson(lightranger9_btdata_t *meas, char *json, uint1
                              meas->photon_count,
                              meas->reference_count,
                              meas->sys_tick_sec,
+                             meas->zones,
+                             meas->kilo_iterations,
                              dist_res);
 
         /**
@@ -627,22 +730,25 @@ void main(void)
              * Prepare a JSON message containing the measurements
              * and print the payload
              */
-            mqttMeasurementToJson(&gMeasurement, gMessageToPublish, sizeof(gMessageToPublish));
-            printk("%s\n\n", gMessageToPublish);
-
-            /**
-             * Publish the JSON message
-             */
-            mqtt_ret = uMqttClientPublish(mqttClientCtx,
-                                          MQTT_TOPIC,
-                                          gMessageToPublish,
-                                          strlen(gMessageToPublish),
-                                          0,
-                                          0);
-            if (mqtt_ret == 0) {
-                printk("Published\r\n\r\n");
+            if (mqttMeasurementToJson(&gMeasurement, gMessageToPublish, sizeof(gMessageToPublish))) {
+                printk("%s\n\n", gMessageToPublish);
+
+                /**
+                 * Publish the JSON message
+                 */
+                mqtt_ret = uMqttClientPublish(mqttClientCtx,
+                                              MQTT_TOPIC,
+                                              gMessageToPublish,
+                                              strlen(gMessageToPublish),
+                                              0,
+                                              0);
+                if (mqtt_ret == 0) {
+                    printk("Published\r\n\r\n");
+                } else {
+                    printk("Publish failed\r\n");
+                }
             } else {
-                printk("Publish failed\r\n");
+                // do nothing
             }
 
             /**
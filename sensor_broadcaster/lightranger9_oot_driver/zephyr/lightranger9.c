@@ -48,14 +48,25 @@
 #include <kernel.h>
 #include <drivers/sensor.h>
 #include <sys/__assert.h>
+#include <sys/byteorder.h>
 #include <logging/log.h>
 #include <drivers/gpio.h>
 #include <drivers/sensor.h>
 #include <string.h>
 #include <init.h>
+#ifdef CONFIG_SOC_NRF5340_CPUAPP
 #include <hal/nrf_gpio.h>
-
+#endif
+#include <pm/device.h>
+#include <pm/device_runtime.h>
+#include <settings/settings.h>
+
+#ifdef CONFIG_LIGHTRANGER9_FW_COMPRESSED
+#include "tof_bin_image_lzss.h"
+#else
 #include "tof_bin_image.h"
+#define TOF_BIN_IMAGE_SIZE      sizeof(tof_bin_image)
+#endif
 #include "lightranger9.h"
 
 LOG_MODULE_REGISTER(LIGHTRANGER9, CONFIG_SENSOR_LOG_LEVEL);
@@ -64,25 +75,192 @@ LOG_MODULE_REGISTER(LIGHTRANGER9, CONFIG_SENSOR_LOG_LEVEL);
  * COMPILE-TIME MACROS
  * -------------------------------------------------------------- */
 
-#define BL_MAX_CHUNK_BYTES      128
+#define BL_MAX_CHUNK_BYTES      LIGHTRANGER9_BL_MAX_CHUNK_BYTES
 #define BL_DOWNLOAD_INIT_SEED   0x29
 #define BL_START_ADDRESS        0x0000
 
+/**
+ * Bootloader status polling back-off, in microseconds.
+ * A 128 byte chunk is processed well within the first poll interval,
+ * the back-off only kicks in for the slower RAM remap and reset.
+ */
+#define BL_POLL_MIN_US          20
+#define BL_POLL_MAX_US          1000
+
+/**
+ * Settings key of the factory calibration, below the device name.
+ */
+#define FC_SETTINGS_ROOT        "lightranger9"
+#define FC_SETTINGS_KEY         "fc"
+#define FC_SETTINGS_NAME_LEN    48
+
+/**
+ * App CMD_STAT values below this are status codes, above it commands.
+ */
+#define CMD_STAT_STATUS_LIMIT   0x10
+
+/**
+ * Bus transaction accounting, compiled out without CONFIG_LIGHTRANGER9_BUS_STATS.
+ */
+#ifdef CONFIG_LIGHTRANGER9_BUS_STATS
+#define BUS_STATS_START(start)                  uint32_t start = k_cycle_get_32()
+#define BUS_STATS_RECORD(dev, op, start, ret)   lightranger9_bus_record(dev, op, start, ret)
+#else
+#define BUS_STATS_START(start)
+#define BUS_STATS_RECORD(dev, op, start, ret)
+#endif
+
 /* ----------------------------------------------------------------
  * TYPES
  * -------------------------------------------------------------- */
 
-static lightranger9_meas_cpt_t lightranger9_meas_cpt;
-                                                    
-static const lightranger9_config_t lightranger9_config = {
-    .bus = I2C_DT_SPEC_INST_GET(0),
-    .control_ctrl = DEVICE_DT_GET(DT_GPIO_CTLR(DT_DRV_INST(0), control_gpios)),
-    .control_pin = DT_INST_GPIO_PIN_BY_IDX(0, control_gpios, 0),
-    .control_flags = DT_INST_GPIO_FLAGS_BY_IDX(0, control_gpios, 0),
-    .int_pin = DT_INST_GPIO_PIN_BY_IDX(0, control_gpios, 1),
-    .int_flags = DT_INST_GPIO_FLAGS_BY_IDX(0, control_gpios, 1),
-    .gpio1_pin = DT_INST_GPIO_PIN_BY_IDX(0, control_gpios, 2),
-    .gpio1_flags = DT_INST_GPIO_FLAGS_BY_IDX(0, control_gpios, 2)
+#ifdef CONFIG_LIGHTRANGER9_FW_COMPRESSED
+/**
+ * State of the LZSS firmware image decoder,
+ * see scripts/compress_tof_image.py for the stream format.
+ */
+typedef struct lightranger9_fw_stream_type {
+    uint32_t src_pos;
+    uint16_t win_pos;
+    uint16_t match_dist;
+    uint8_t match_left;
+    uint8_t flags;
+    uint8_t flag_cnt;
+} lightranger9_fw_stream_t;
+
+#define FW_WINDOW_SIZE          (1U << TOF_BIN_IMAGE_LZSS_WINDOW_BITS)
+#define FW_LEN_BITS             (16 - TOF_BIN_IMAGE_LZSS_WINDOW_BITS)
+
+/**
+ * History of the last decoded bytes, back references point into it.
+ * One window is shared by all instances to save RAM, fw_lock keeps
+ * downloads of different sensors (e.g. recovering on their own trigger
+ * threads, or resuming together) from decoding through it at once.
+ */
+static uint8_t lightranger9_fw_window[FW_WINDOW_SIZE];
+static K_MUTEX_DEFINE(lightranger9_fw_lock);
+#endif
+
+/**
+ * Source result and destination zone (row * cols + col) of one result
+ * of a sub-capture.
+ */
+typedef struct lightranger9_zone_map_type {
+    uint8_t src;
+    uint8_t dst;
+} lightranger9_zone_map_t;
+
+/**
+ * Frame layout of a zone mode. The map holds 2 * obj_entries entries
+ * per sub-capture, obj1 first and obj2 second.
+ */
+typedef struct lightranger9_zone_layout_type {
+    const lightranger9_zone_map_t *map;
+    uint8_t sub_captures;
+    uint8_t obj_entries;
+    uint8_t zones;
+    uint8_t spad_map_id;
+    uint8_t mode_cmd;
+} lightranger9_zone_layout_t;
+
+/* ----------------------------------------------------------------
+ * VARIABLES
+ * -------------------------------------------------------------- */
+
+/**
+ * Every 9th result of a sub-capture is unused, so 32 of the 36 results
+ * end up in a zone. Entry i of a sub-capture maps result i + i / 8,
+ * the first half of the entries go to obj1 and the second to obj2.
+ */
+#define ZONE_MAP_ENTRIES        32
+#define ZONE_MAP_OBJ_ENTRIES    (ZONE_MAP_ENTRIES / 2)
+
+/**
+ * Offset of a result or register within a raw capture block.
+ */
+#define BLOCK_OFFSET(reg)       ((reg) - LIGHTRANGER9_REG_BLOCKREAD)
+#define BLOCK_RESULT(r)         (BLOCK_OFFSET(LIGHTRANGER9_REG_RES_CONFIDENCE_0) + ((r) * 3))
+
+/**
+ * Value of a register within the encoded registers, which start at RESULT_NUMBER.
+ */
+#define REGS_OFFSET(reg)        ((reg) - LIGHTRANGER9_REG_RESULT_NUMBER)
+#define REGS_VAL(regs, reg)     ((regs)[REGS_OFFSET(reg)])
+
+#define ZONE_SRC(i)             ((i) + ((i) / 8))
+#define ZONE_ROW(sc, r)         ((((r) % 9) / 2) * 2 + ((sc) / 2))
+#define ZONE_COL(sc, r)         ((((r) % 9) % 2) * 4 + (((r) % 18) / 9) + (((sc) % 2) * 2))
+#define ZONE_DST(sc, r)         (ZONE_ROW(sc, r) * 8 + ZONE_COL(sc, r))
+#define ZONE_ENTRY(sc, i)       { ZONE_SRC(i), ZONE_DST(sc, ZONE_SRC(i)) }
+
+#define ZONE_ENTRIES_8(sc, b)   ZONE_ENTRY(sc, (b) + 0), ZONE_ENTRY(sc, (b) + 1), \
+                                ZONE_ENTRY(sc, (b) + 2), ZONE_ENTRY(sc, (b) + 3), \
+                                ZONE_ENTRY(sc, (b) + 4), ZONE_ENTRY(sc, (b) + 5), \
+                                ZONE_ENTRY(sc, (b) + 6), ZONE_ENTRY(sc, (b) + 7)
+#define ZONE_SUBCAPTURE(sc)     ZONE_ENTRIES_8(sc, 0),  ZONE_ENTRIES_8(sc, 8), \
+                                ZONE_ENTRIES_8(sc, 16), ZONE_ENTRIES_8(sc, 24)
+
+static const lightranger9_zone_map_t lightranger9_zone_map_8x8[(LIGHTRANGER9_SUBCAPTURE_3 + 1) * ZONE_MAP_ENTRIES] = {
+    ZONE_SUBCAPTURE(LIGHTRANGER9_SUBCAPTURE_0),
+    ZONE_SUBCAPTURE(LIGHTRANGER9_SUBCAPTURE_1),
+    ZONE_SUBCAPTURE(LIGHTRANGER9_SUBCAPTURE_2),
+    ZONE_SUBCAPTURE(LIGHTRANGER9_SUBCAPTURE_3),
+};
+
+/**
+ * In the TMF8820 modes result channel ch of an object is result ch of obj1
+ * and result 18 + ch of obj2. 4x4 multiplexes two SPAD halves, sub-capture
+ * sc holds zones sc * 8 up to sc * 8 + 7.
+ */
+#define ZONE_LEGACY_SRC(obj, ch)        (((obj) * (LIGHTRANGER9_MAX_MEAS_RESULTS / 2)) + (ch))
+#define ZONE_LEGACY_ENTRY(sc, n, obj, ch) { ZONE_LEGACY_SRC(obj, ch), ((sc) * (n)) + (ch) }
+#define ZONE_LEGACY_ENTRIES_8(sc, n, obj) \
+                                ZONE_LEGACY_ENTRY(sc, n, obj, 0), ZONE_LEGACY_ENTRY(sc, n, obj, 1), \
+                                ZONE_LEGACY_ENTRY(sc, n, obj, 2), ZONE_LEGACY_ENTRY(sc, n, obj, 3), \
+                                ZONE_LEGACY_ENTRY(sc, n, obj, 4), ZONE_LEGACY_ENTRY(sc, n, obj, 5), \
+                                ZONE_LEGACY_ENTRY(sc, n, obj, 6), ZONE_LEGACY_ENTRY(sc, n, obj, 7)
+
+static const lightranger9_zone_map_t lightranger9_zone_map_4x4[2 * 16] = {
+    ZONE_LEGACY_ENTRIES_8(0, 8, 0), ZONE_LEGACY_ENTRIES_8(0, 8, 1),
+    ZONE_LEGACY_ENTRIES_8(1, 8, 0), ZONE_LEGACY_ENTRIES_8(1, 8, 1),
+};
+
+static const lightranger9_zone_map_t lightranger9_zone_map_3x3[18] = {
+    ZONE_LEGACY_ENTRIES_8(0, 9, 0), ZONE_LEGACY_ENTRY(0, 9, 0, 8),
+    ZONE_LEGACY_ENTRIES_8(0, 9, 1), ZONE_LEGACY_ENTRY(0, 9, 1, 8),
+};
+
+/**
+ * Indexed by enum lightranger9_zone_mode.
+ */
+BUILD_ASSERT(ZONE_MAP_OBJ_ENTRIES <= LIGHTRANGER9_PARTIAL_MAX_ZONES,
+             "a sub-capture does not fit a partial frame");
+
+static const lightranger9_zone_layout_t lightranger9_zone_layouts[] = {
+    [LIGHTRANGER9_ZONE_MODE_8X8] = {
+        .map          = lightranger9_zone_map_8x8,
+        .sub_captures = LIGHTRANGER9_SUBCAPTURE_3 + 1,
+        .obj_entries  = ZONE_MAP_OBJ_ENTRIES,
+        .zones        = 64,
+        .spad_map_id  = 0,
+        .mode_cmd     = LIGHTRANGER9_CMD_STAT_FORCE_TMF8828,
+    },
+    [LIGHTRANGER9_ZONE_MODE_4X4] = {
+        .map          = lightranger9_zone_map_4x4,
+        .sub_captures = 2,
+        .obj_entries  = 8,
+        .zones        = 16,
+        .spad_map_id  = LIGHTRANGER9_SPAD_MAP_4X4,
+        .mode_cmd     = LIGHTRANGER9_CMD_STAT_FORCE_TMF8820,
+    },
+    [LIGHTRANGER9_ZONE_MODE_3X3] = {
+        .map          = lightranger9_zone_map_3x3,
+        .sub_captures = 1,
+        .obj_entries  = 9,
+        .zones        = 9,
+        .spad_map_id  = LIGHTRANGER9_SPAD_MAP_3X3,
+        .mode_cmd     = LIGHTRANGER9_CMD_STAT_FORCE_TMF8820,
+    },
 };
 
 /* ----------------------------------------------------------------
@@ -90,6 +268,40 @@ static const lightranger9_config_t lightranger9_config = {
  * -------------------------------------------------------------- */
 
 static int lightranger9_clear_interrupts (const struct device *dev);
+#ifdef CONFIG_LIGHTRANGER9_BUS_STATS
+static void lightranger9_bus_record(const struct device *dev,
+                                    enum lightranger9_bus_op op,
+                                    uint32_t start,
+                                    int ret);
+#endif
+static bool lightranger9_frame_claim(lightranger9_data_t *data,
+                                     const lightranger9_zone_layout_t *layout,
+                                     uint8_t sub_capture,
+                                     uint8_t result_number);
+static bool lightranger9_frame_complete(lightranger9_data_t *data,
+                                        const lightranger9_zone_layout_t *layout);
+static void lightranger9_frame_reset(lightranger9_data_t *data);
+static uint8_t lightranger9_result_slot(const lightranger9_zone_layout_t *layout,
+                                       uint8_t result_number,
+                                       uint8_t *frame_number);
+static int lightranger9_decode_channel(const uint8_t *regs,
+                                      uint8_t zone_mode,
+                                      enum sensor_channel chan,
+                                      struct sensor_value *val);
+static void lightranger9_decode_capture(const uint8_t *data_buf,
+                                        const lightranger9_zone_layout_t *layout,
+                                        uint8_t confidence_threshold,
+                                        lightranger9_meas_cpt_t *data);
+#ifdef CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION
+static int lightranger9_load_calibration(const struct device *dev);
+#endif
+static int lightranger9_recover(const struct device *dev, int fault);
+static const struct sensor_driver_api lightranger9_api;
+#ifdef CONFIG_LIGHTRANGER9_ADAPTIVE_ITERATIONS
+static void lightranger9_adapt_iterations(const struct device *dev,
+                                          const lightranger9_measurement_t *frame);
+static void lightranger9_apply_iterations(const struct device *dev, const uint8_t *block);
+#endif
 
 /* ----------------------------------------------------------------
  * PUBLIC FUNCTIONS
@@ -97,8 +309,11 @@ static int lightranger9_clear_interrupts (const struct device *dev);
 
 void lightranger9_get_measurements(const struct device *dev, lightranger9_meas_cpt_t *sens_data)
 {
-    lightranger9_meas_cpt_t *data = dev->data;
-    memcpy(sens_data, data, sizeof(lightranger9_meas_cpt_t));
+    lightranger9_data_t *data = dev->data;
+    lightranger9_decode_capture(data->read_block,
+                                &lightranger9_zone_layouts[data->zone_mode],
+                                data->confidence_threshold,
+                                sens_data);
 }
 
 void lightranger9_clear_ints(const struct device *dev)
@@ -111,34 +326,49 @@ bool lightranger9_get_interrupt_pin(const struct device *dev)
     const lightranger9_config_t *cfg = dev->config;
     bool ret;
 
+#ifdef CONFIG_LIGHTRANGER9_REPLAY
+    // a recorded capture is always ready, the replay paces itself
+    ARG_UNUSED(cfg);
+    ret = false;
+#else
     ret = gpio_pin_get(cfg->control_ctrl, cfg->int_pin);
+#endif
 
     return ret;
 }
 
-bool lightranger9_parse_measurement(lightranger9_meas_cpt_t *capture, lightranger9_measurement_t *parsed_data)
+bool lightranger9_is_device(const struct device *dev)
+{
+    return (dev != NULL) && (dev->api == &lightranger9_api);
+}
+
+bool lightranger9_parse_measurement(const struct device *dev,
+                                    lightranger9_meas_cpt_t *capture,
+                                    lightranger9_measurement_t *parsed_data)
 {
+    lightranger9_data_t *data = dev->data;
+    const lightranger9_zone_layout_t *layout = &lightranger9_zone_layouts[data->zone_mode];
+    const lightranger9_zone_map_t *map;
+    uint8_t sc = capture->sub_capture & LIGHTRANGER9_SUBCAPTURE_MASK;
+    uint8_t i;
     bool ret;
-    static uint8_t sub_capture_cnt = 0;
-    uint8_t result_cnt = 0, row = 0, col = 0;
-
-    for (result_cnt = 0; result_cnt < LIGHTRANGER9_MAX_MEAS_RESULTS; result_cnt++) {
-        if (8 == (result_cnt % 9)) {
-            continue;
-        }
-        row = (((result_cnt % 9) / 2) * 2) + (capture->sub_capture / 2);
-        col = (((result_cnt % 9) % 2) * 4) + ((result_cnt % 18) / 9) + ((capture->sub_capture % 2) * 2);
-        if (result_cnt >= ( LIGHTRANGER9_MAX_MEAS_RESULTS / 2)) {
-            parsed_data->obj2[(row * 8) + col].distance_mm = capture->result[result_cnt].distance_mm;
-            parsed_data->obj2[(row * 8) + col].confidence  = capture->result[result_cnt].confidence;
-        } else {
-            parsed_data->obj1[(row * 8) + col].distance_mm = capture->result[result_cnt].distance_mm;
-            parsed_data->obj1[(row * 8) + col].confidence  = capture->result[result_cnt].confidence;
-        }
+#ifdef CONFIG_PM_DEVICE
+    k_spinlock_key_t key;
+#endif
+
+    if (!lightranger9_frame_claim(data, layout, sc, capture->result_number)) {
+        return false;
     }
 
-    if (sub_capture_cnt < LIGHTRANGER9_SUBCAPTURE_3) {
-        sub_capture_cnt++;
+    map = &layout->map[sc * 2 * layout->obj_entries];
+    for (i = 0; i < layout->obj_entries; i++) {
+        parsed_data->obj1[map[i].dst] = capture->result[map[i].src];
+    }
+    for (map += layout->obj_entries, i = 0; i < layout->obj_entries; i++) {
+        parsed_data->obj2[map[i].dst] = capture->result[map[i].src];
+    }
+
+    if (!lightranger9_frame_complete(data, layout)) {
         ret = false;
     } else {
         parsed_data->result_number   = capture->result_number;
@@ -148,28 +378,404 @@ bool lightranger9_parse_measurement(lightranger9_meas_cpt_t *capture, lightrange
         parsed_data->photon_count    = capture->photon_count;
         parsed_data->reference_count = capture->reference_count;
         parsed_data->sys_tick_sec    = capture->sys_tick_sec;
+        parsed_data->zones           = layout->zones;
+        parsed_data->kilo_iterations = data->read_kilo;
         
-        sub_capture_cnt = 0;
         ret = true;
+#ifdef CONFIG_PM_DEVICE
+        // read by lightranger9_get_pm_stats() from other threads
+        key = k_spin_lock(&data->lock);
+        data->pm_stats.frames++;
+        k_spin_unlock(&data->lock, key);
+#endif
+#ifdef CONFIG_LIGHTRANGER9_ADAPTIVE_ITERATIONS
+        lightranger9_adapt_iterations(dev, parsed_data);
+#endif
+    }
+
+    return ret;
+}
+
+bool lightranger9_decode_frame(const struct device *dev,
+                               lightranger9_measurement_t *frame)
+{
+    lightranger9_data_t *data = dev->data;
+    const uint8_t *block = data->read_block;
+    const uint8_t threshold = data->confidence_threshold;
+    const lightranger9_zone_layout_t *layout = &lightranger9_zone_layouts[data->zone_mode];
+    const lightranger9_zone_map_t *map;
+    const uint8_t *res;
+    uint8_t rn;
+    uint8_t sc = lightranger9_result_slot(layout, block[BLOCK_OFFSET(LIGHTRANGER9_REG_RESULT_NUMBER)], &rn);
+    uint8_t i;
+    bool ret;
+#ifdef CONFIG_PM_DEVICE
+    k_spinlock_key_t key;
+#endif
+
+    if (!lightranger9_frame_claim(data, layout, sc, rn)) {
+        return false;
+    }
+
+    /**
+     * Each sub-capture writes its own zones of both object maps,
+     * together the sub-captures of a frame overwrite every used slot.
+     */
+    map = &layout->map[sc * 2 * layout->obj_entries];
+    for (i = 0; i < layout->obj_entries; i++) {
+        res = &block[BLOCK_RESULT(map[i].src)];
+        frame->obj1[map[i].dst].confidence  = res[0];
+        frame->obj1[map[i].dst].distance_mm = (res[0] >= threshold) ?
+                                              (((uint16_t)res[2] << 8) | res[1]) : 0;
+    }
+    for (map += layout->obj_entries, i = 0; i < layout->obj_entries; i++) {
+        res = &block[BLOCK_RESULT(map[i].src)];
+        frame->obj2[map[i].dst].confidence  = res[0];
+        frame->obj2[map[i].dst].distance_mm = (res[0] >= threshold) ?
+                                              (((uint16_t)res[2] << 8) | res[1]) : 0;
+    }
+
+    if (!lightranger9_frame_complete(data, layout)) {
+        ret = false;
+    } else {
+        // frame header is taken from the last sub-capture only
+        frame->result_number   = rn;
+        frame->temperature     = (int8_t)block[BLOCK_OFFSET(LIGHTRANGER9_REG_TEMPERATURE)];
+        frame->valid_results   = block[BLOCK_OFFSET(LIGHTRANGER9_REG_NUMBER_VALID_RESULTS)];
+        frame->ambient_light   = sys_get_le32(&block[BLOCK_OFFSET(LIGHTRANGER9_REG_AMBIENT_LIGHT_0)]);
+        frame->photon_count    = sys_get_le32(&block[BLOCK_OFFSET(LIGHTRANGER9_REG_PHOTON_COUNT_0)]);
+        frame->reference_count = sys_get_le32(&block[BLOCK_OFFSET(LIGHTRANGER9_REG_REFERENCE_COUNT_0)]);
+        frame->sys_tick_sec    = sys_get_le32(&block[BLOCK_OFFSET(LIGHTRANGER9_REG_SYS_TICK_0)]) *
+                                 LIGHTRANGER9_SYS_TICK_TO_SEC;
+        frame->zones           = layout->zones;
+        frame->kilo_iterations = data->read_kilo;
+
+        ret = true;
+#ifdef CONFIG_PM_DEVICE
+        // read by lightranger9_get_pm_stats() from other threads
+        key = k_spin_lock(&data->lock);
+        data->pm_stats.frames++;
+        k_spin_unlock(&data->lock, key);
+#endif
+#ifdef CONFIG_LIGHTRANGER9_ADAPTIVE_ITERATIONS
+        lightranger9_adapt_iterations(dev, frame);
+#endif
     }
 
     return ret;
 }
 
+bool lightranger9_decode_partial(const struct device *dev,
+                                 lightranger9_partial_t *partial)
+{
+    lightranger9_data_t *data = dev->data;
+    const uint8_t *block = data->read_block;
+    const uint8_t threshold = data->confidence_threshold;
+    const lightranger9_zone_layout_t *layout = &lightranger9_zone_layouts[data->zone_mode];
+    const lightranger9_zone_map_t *map;
+    const uint8_t *res;
+    uint8_t rn;
+    uint8_t sc = lightranger9_result_slot(layout, block[BLOCK_OFFSET(LIGHTRANGER9_REG_RESULT_NUMBER)], &rn);
+    uint8_t i;
+
+    partial->result_number = rn;
+    partial->sub_capture   = sc;
+    partial->zones         = layout->zones;
+    partial->count         = layout->obj_entries;
+
+    /**
+     * Entry i of obj2 lies in the same zone as entry i of obj1,
+     * its result is 18 further on.
+     */
+    map = &layout->map[sc * 2 * layout->obj_entries];
+    for (i = 0; i < layout->obj_entries; i++) {
+        partial->zone[i] = map[i].dst;
+        res = &block[BLOCK_RESULT(map[i].src)];
+        partial->obj1[i].confidence  = res[0];
+        partial->obj1[i].distance_mm = (res[0] >= threshold) ?
+                                       (((uint16_t)res[2] << 8) | res[1]) : 0;
+    }
+    for (map += layout->obj_entries, i = 0; i < layout->obj_entries; i++) {
+        res = &block[BLOCK_RESULT(map[i].src)];
+        partial->obj2[i].confidence  = res[0];
+        partial->obj2[i].distance_mm = (res[0] >= threshold) ?
+                                       (((uint16_t)res[2] << 8) | res[1]) : 0;
+    }
+
+    return true;
+}
+
+uint32_t lightranger9_get_timestamp(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    return data->read_stamp;
+}
+
+void lightranger9_encode(const struct device *dev, lightranger9_encoded_capture_t *enc)
+{
+    lightranger9_data_t *data = dev->data;
+
+    enc->timestamp = data->read_stamp;
+    enc->confidence_threshold = data->confidence_threshold;
+    enc->zone_mode = data->zone_mode;
+    memcpy(enc->regs,
+           &data->read_block[BLOCK_OFFSET(LIGHTRANGER9_REG_RESULT_NUMBER)],
+           LIGHTRANGER9_ENCODED_REGS_SIZE);
+}
+
+int lightranger9_decode(const lightranger9_encoded_capture_t *enc,
+                        enum sensor_channel chan,
+                        struct sensor_value *val)
+{
+    if (enc->zone_mode >= ARRAY_SIZE(lightranger9_zone_layouts)) {
+        return -EINVAL;
+    }
+
+    return lightranger9_decode_channel(enc->regs, enc->zone_mode, chan, val);
+}
+
+int lightranger9_decode_zone(const lightranger9_encoded_capture_t *enc,
+                             uint8_t zone,
+                             uint8_t obj,
+                             struct sensor_value *val)
+{
+    const lightranger9_zone_layout_t *layout;
+    const lightranger9_zone_map_t *map;
+    uint8_t sc;
+    uint8_t rn;
+    uint8_t i;
+    const uint8_t *res;
+    uint16_t distance_mm;
+
+    if ((enc->zone_mode >= ARRAY_SIZE(lightranger9_zone_layouts)) || (obj > 1)) {
+        return -EINVAL;
+    }
+    layout = &lightranger9_zone_layouts[enc->zone_mode];
+    if (zone >= layout->zones) {
+        return -EINVAL;
+    }
+
+    sc = lightranger9_result_slot(layout, REGS_VAL(enc->regs, LIGHTRANGER9_REG_RESULT_NUMBER), &rn);
+    map = &layout->map[((sc * 2) + obj) * layout->obj_entries];
+    for (i = 0; i < layout->obj_entries; i++) {
+        if (map[i].dst == zone) {
+            break;
+        }
+    }
+    if (i == layout->obj_entries) {
+        // zone is measured by another sub-capture
+        return -ENODATA;
+    }
+
+    res = &enc->regs[REGS_OFFSET(LIGHTRANGER9_REG_RES_CONFIDENCE_0) + (map[i].src * 3)];
+    if (res[0] >= enc->confidence_threshold) {
+        distance_mm = ((uint16_t)res[2] << 8) | res[1];
+    } else {
+        distance_mm = 0;
+    }
+    val->val1 = distance_mm / 1000;
+    val->val2 = (distance_mm % 1000) * 1000;
+
+    return 0;
+}
+
+#ifdef CONFIG_PM_DEVICE
+void lightranger9_get_pm_stats(const struct device *dev, lightranger9_pm_stats_t *stats)
+{
+    lightranger9_data_t *data = dev->data;
+    k_spinlock_key_t key;
+    uint32_t elapsed_ms;
+    uint64_t charge_uc;
+
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+    key = k_spin_lock(&data->lock);
+    *stats = data->pm_stats;
+    k_spin_unlock(&data->lock, key);
+    elapsed_ms = k_uptime_get_32() - data->pm_since_ms;
+    if (data->standby) {
+        stats->standby_ms += elapsed_ms;
+    } else {
+        stats->active_ms += elapsed_ms;
+    }
+    k_mutex_unlock(&data->cmd_lock);
+
+    // uA * ms gives nC
+    charge_uc = (((uint64_t)stats->active_ms * CONFIG_LIGHTRANGER9_ACTIVE_CURRENT_UA) +
+                 ((uint64_t)stats->standby_ms * CONFIG_LIGHTRANGER9_STANDBY_CURRENT_UA)) / 1000;
+    stats->charge_per_frame_uc = (stats->frames > 0) ? (uint32_t)(charge_uc / stats->frames) : 0;
+}
+#endif
+
+void lightranger9_get_fifo_stats(const struct device *dev, lightranger9_fifo_stats_t *stats)
+{
+    lightranger9_data_t *data = dev->data;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&data->lock);
+    *stats = data->fifo_stats;
+    stats->pending = data->fifo_count - (data->fifo_claimed ? 1 : 0);
+    k_spin_unlock(&data->lock, key);
+}
+
+void lightranger9_get_frame_stats(const struct device *dev, lightranger9_frame_stats_t *stats)
+{
+    lightranger9_data_t *data = dev->data;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&data->lock);
+    *stats = data->frame_stats;
+    k_spin_unlock(&data->lock, key);
+}
+
+void lightranger9_get_fault_stats(const struct device *dev, lightranger9_fault_stats_t *stats)
+{
+    lightranger9_data_t *data = dev->data;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&data->lock);
+    *stats = data->fault_stats;
+    k_spin_unlock(&data->lock, key);
+}
+
+#ifdef CONFIG_LIGHTRANGER9_BUS_STATS
+void lightranger9_get_bus_stats(const struct device *dev, lightranger9_bus_stats_t *stats)
+{
+    lightranger9_data_t *data = dev->data;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&data->lock);
+    *stats = data->bus_stats;
+    k_spin_unlock(&data->lock, key);
+}
+
+void lightranger9_reset_bus_stats(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&data->lock);
+    memset(&data->bus_stats, 0, sizeof(data->bus_stats));
+    k_spin_unlock(&data->lock, key);
+}
+#endif
+
 /* ----------------------------------------------------------------
  * STATIC FUNCTIONS
  * -------------------------------------------------------------- */
 
-static uint8_t lightranger9_calculate_checksum(uint8_t *data_in, uint8_t len)
+#ifdef CONFIG_LIGHTRANGER9_BUS_STATS
+static void lightranger9_bus_record(const struct device *dev,
+                                    enum lightranger9_bus_op op,
+                                    uint32_t start,
+                                    int ret)
 {
-    uint16_t data_sum = 0;
-    uint8_t cnt;
+    lightranger9_data_t *data = dev->data;
+    lightranger9_bus_op_stats_t *stats = &data->bus_stats.op[op];
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+    uint8_t bucket = (us == 0) ? 0 : (32 - __builtin_clz(us));
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&data->lock);
+    stats->count++;
+    if (ret) {
+        stats->errors++;
+    } else {
+        // do nothing
+    }
+    stats->max_us = MAX(stats->max_us, us);
+    stats->total_us += us;
+    stats->hist[MIN(bucket, LIGHTRANGER9_BUS_HIST_BUCKETS - 1)]++;
+    k_spin_unlock(&data->lock, key);
+}
+#endif
 
-    for (cnt = 0; cnt < len; cnt++) {
-        data_sum += data_in[cnt];
+static uint8_t lightranger9_result_slot(const lightranger9_zone_layout_t *layout,
+                                       uint8_t result_number,
+                                       uint8_t *frame_number)
+{
+    /**
+     * In 8x8 RESULT_NUMBER holds the frame number in bits 7:2 and the
+     * sub-capture in bits 1:0. In the TMF8820 modes it is a plain result
+     * counter, restarted with every measurement: 3x3 needs one result per
+     * frame, while 4x4 alternates between its two time-multiplexed SPAD
+     * halves starting with the first, so the lowest bit tells the half.
+     */
+    *frame_number = result_number / layout->sub_captures;
+
+    return result_number % layout->sub_captures;
+}
+
+/**
+ * @brief Counts a frame assembly event, frame_stats is read from other
+ * threads by lightranger9_get_frame_stats().
+ */
+static void lightranger9_frame_count(lightranger9_data_t *data, uint32_t *counter)
+{
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&data->lock);
+    (*counter)++;
+    k_spin_unlock(&data->lock, key);
+}
+
+static bool lightranger9_frame_claim(lightranger9_data_t *data,
+                                     const lightranger9_zone_layout_t *layout,
+                                     uint8_t sub_capture,
+                                     uint8_t result_number)
+{
+    if (sub_capture >= layout->sub_captures) {
+        // e.g. left over from before a zone mode change
+        lightranger9_frame_count(data, &data->frame_stats.dropped);
+        return false;
     }
 
-    return (uint8_t)((~data_sum) & 0xFF);
+    /**
+     * All sub-captures of a frame share its result number. One of another
+     * frame means a sub-capture was missed, the zones collected so far
+     * belong to a different instant and are not emitted. The same goes
+     * for sub-captures queued from before a kilo iterations change.
+     */
+    if ((data->frame_slots != 0) &&
+        ((result_number != data->frame_result_number) || (data->read_kilo != data->frame_kilo))) {
+        lightranger9_frame_count(data, &data->frame_stats.partial);
+        data->frame_slots = 0;
+    } else {
+        // do nothing
+    }
+
+    if (data->frame_slots & BIT(sub_capture)) {
+        lightranger9_frame_count(data, &data->frame_stats.dropped);
+        return false;
+    }
+
+    data->frame_result_number = result_number;
+    data->frame_kilo = data->read_kilo;
+    data->frame_slots |= BIT(sub_capture);
+
+    return true;
+}
+
+static bool lightranger9_frame_complete(lightranger9_data_t *data,
+                                        const lightranger9_zone_layout_t *layout)
+{
+    if (data->frame_slots != BIT_MASK(layout->sub_captures)) {
+        return false;
+    }
+
+    data->frame_slots = 0;
+    lightranger9_frame_count(data, &data->frame_stats.frames);
+
+    return true;
+}
+
+static void lightranger9_frame_reset(lightranger9_data_t *data)
+{
+    if (data->frame_slots != 0) {
+        lightranger9_frame_count(data, &data->frame_stats.partial);
+        data->frame_slots = 0;
+    } else {
+        // do nothing
+    }
 }
 
 static int lightranger9_generic_write(const struct device *dev,
@@ -178,16 +784,24 @@ static int lightranger9_generic_write(const struct device *dev,
                                       uint8_t len)
 {
     const lightranger9_config_t *cfg = dev->config;
-    uint8_t data_buf[256] = {0};
-    uint8_t cnt;
+    lightranger9_data_t *data = dev->data;
     int ret;
 
-    data_buf[0] = reg;
-    for (cnt = 0; cnt < len; cnt++ ) {
-        data_buf[cnt + 1] = data_in[cnt];
+    if (len >= LIGHTRANGER9_TX_BUF_SIZE) {
+        return -EINVAL;
     }
 
-    ret = i2c_write_dt(&cfg->bus, data_buf, len + 1);
+    // cmd_lock is recursive, callers sequencing commands may hold it already
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+
+    data->tx_buf[0] = reg;
+    memcpy(&data->tx_buf[1], data_in, len);
+
+    BUS_STATS_START(start);
+    ret = i2c_write_dt(&cfg->bus, data->tx_buf, len + 1);
+    BUS_STATS_RECORD(dev, LIGHTRANGER9_BUS_OP_REG_WRITE, start, ret);
+
+    k_mutex_unlock(&data->cmd_lock);
 
     return ret;
 }
@@ -202,7 +816,14 @@ static int lightranger9_read_register(const struct device *dev,
     uint8_t tx_buf[1];
 
     tx_buf[0] = reg_addr;
+
+    BUS_STATS_START(start);
     ret = i2c_write_read_dt(&cfg->bus, tx_buf, 1, rx_buf, rx_len);
+    // result blocks, histograms and calibration pages are all at least a block long
+    BUS_STATS_RECORD(dev,
+                     (rx_len >= LIGHTRANGER9_BLOCKREAD_SIZE) ?
+                     LIGHTRANGER9_BUS_OP_BLOCK_READ : LIGHTRANGER9_BUS_OP_REG_READ,
+                     start, ret);
 
     return ret;
 }
@@ -235,23 +856,33 @@ bool lightranger9_check_communication(const struct device *dev)
     return ret;
 }
 
-static int lightranger9_write_bl_cmd(const struct device *dev,
-                                     uint8_t cmd,
-                                     uint8_t *data_in,
-                                     uint8_t len)
+/**
+ * @brief Waits before polling the sensor again. Most commands are done
+ * within microseconds, so the first polls spin with a doubling delay.
+ * From BL_POLL_MAX_US on the thread sleeps instead, so a slow or faulting
+ * sensor does not keep the CPU from other threads until LIGHTRANGER9_TIMEOUT.
+ */
+static void lightranger9_poll_wait(uint32_t *delay_us)
 {
-    uint8_t data_buf[256] = {0};
-    uint8_t cnt;
+    if (*delay_us < BL_POLL_MAX_US) {
+        k_busy_wait(*delay_us);
+        *delay_us = MIN(*delay_us * 2, BL_POLL_MAX_US);
+    } else {
+        k_msleep(BL_POLL_MAX_US / USEC_PER_MSEC);
+    }
+}
 
-    data_buf[0] = cmd;
-    data_buf[1] = len;
+#ifndef CONFIG_LIGHTRANGER9_REPLAY
+static uint8_t lightranger9_calculate_checksum(uint8_t *data_in, uint8_t len)
+{
+    uint16_t data_sum = 0;
+    uint8_t cnt;
 
     for (cnt = 0; cnt < len; cnt++) {
-        data_buf[cnt + 2] = data_in[cnt];
+        data_sum += data_in[cnt];
     }
 
-    data_buf[len + 2] = lightranger9_calculate_checksum(data_buf, len + 2);
-    return lightranger9_generic_write(dev, LIGHTRANGER9_REG_CMD_STAT, data_buf, len + 3);
+    return (uint8_t)((~data_sum) & 0xFF);
 }
 
 static int lightranger9_read_bl_cmd_status(const struct device *dev, uint8_t *status)
@@ -266,7 +897,8 @@ static int lightranger9_read_bl_cmd_status(const struct device *dev, uint8_t *st
     if (ret == 0) {
         if ((data_buf[1]) ||
             (data_buf[2] != lightranger9_calculate_checksum(data_buf, 2))) {
-            ret = -1;
+            // command still being processed
+            ret = -EAGAIN;
         } else {
             *status = data_buf[0];
             ret = 0;
@@ -278,201 +910,1370 @@ static int lightranger9_read_bl_cmd_status(const struct device *dev, uint8_t *st
     return ret;
 }
 
-static int lightranger9_download_fw_bin(const struct device *dev)
+static int lightranger9_write_bl_frame(const struct device *dev, uint8_t cmd, uint8_t len)
 {
-    uint8_t data_buf[BL_MAX_CHUNK_BYTES] = {0};
-    int error_flag       = 0;
-    uint16_t timeout_cnt = 0;
-    uint32_t fw_index    = 0;
-    uint8_t chunk_bytes  = 0;
+    const lightranger9_config_t *cfg = dev->config;
+    lightranger9_data_t *data = dev->data;
+    uint8_t *frame = data->tx_buf;
+    int ret;
 
-    error_flag |= lightranger9_read_register(dev,
-                                             LIGHTRANGER9_REG_APPID,
-                                             data_buf,
-                                             1);
-
-    if (LIGHTRANGER9_APP_ID_BOOTLOADER == data_buf[0]) {
-        data_buf[0] = BL_DOWNLOAD_INIT_SEED;
-        error_flag |= lightranger9_write_bl_cmd(dev,
-                                                LIGHTRANGER9_BL_CMD_DOWNLOAD_INIT,
-                                                data_buf,
-                                                1);
-        timeout_cnt = 0;
-        do {
-            k_msleep(1);
-            error_flag |= lightranger9_read_bl_cmd_status (dev, data_buf);
-            if (++timeout_cnt > LIGHTRANGER9_TIMEOUT) {
-                return -1;
-            }
-        } while (LIGHTRANGER9_BL_CMD_STAT_READY != data_buf[0]);
-        
-        data_buf[0] = BL_START_ADDRESS & 0xFF;
-        data_buf[1] = (BL_START_ADDRESS >> 8) & 0xFF;
-        error_flag |= lightranger9_write_bl_cmd(dev,
-                                                LIGHTRANGER9_BL_CMD_ADDR_RAM,
-                                                data_buf,
-                                                2);
-
-        timeout_cnt = 0;
-        do {
-            k_msleep(1);
-            error_flag |= lightranger9_read_bl_cmd_status(dev, data_buf);
-            if (++timeout_cnt > LIGHTRANGER9_TIMEOUT) {
-                return -1;
-            }
-        } while (LIGHTRANGER9_BL_CMD_STAT_READY != data_buf[0]);
-        
-        while (fw_index < sizeof(tof_bin_image)) {
-            if ((fw_index + BL_MAX_CHUNK_BYTES) <= sizeof(tof_bin_image)) {
-                chunk_bytes = BL_MAX_CHUNK_BYTES;
-            } else {
-                chunk_bytes = sizeof(tof_bin_image) - fw_index;
-            }
+    /**
+     * Payload is expected to be in place already at frame[3],
+     * the checksum covers command, size and payload.
+     */
+    frame[0] = LIGHTRANGER9_REG_CMD_STAT;
+    frame[1] = cmd;
+    frame[2] = len;
+    frame[len + 3] = lightranger9_calculate_checksum(&frame[1], len + 2);
 
-            memcpy (data_buf, &tof_bin_image[fw_index], chunk_bytes);
-            error_flag |= lightranger9_write_bl_cmd(dev, LIGHTRANGER9_BL_CMD_W_RAM, data_buf, chunk_bytes);
-            fw_index += chunk_bytes;
-            timeout_cnt = 0;
+    BUS_STATS_START(start);
+    ret = i2c_write_dt(&cfg->bus, frame, len + 4);
+    BUS_STATS_RECORD(dev, LIGHTRANGER9_BUS_OP_BL_CMD, start, ret);
 
-            do {
-                k_msleep(1);
-                error_flag |= lightranger9_read_bl_cmd_status(dev, data_buf);
-                if (++timeout_cnt > LIGHTRANGER9_TIMEOUT) {
-                    return -1;
-                }
-            } while (LIGHTRANGER9_BL_CMD_STAT_READY != data_buf[0]);
+    return ret;
+}
+
+static int lightranger9_wait_bl_ready(const struct device *dev)
+{
+    uint32_t start = k_uptime_get_32();
+    uint32_t delay_us = BL_POLL_MIN_US;
+    uint8_t status = 0xFF;
+    int ret;
+
+    while (true) {
+        ret = lightranger9_read_bl_cmd_status(dev, &status);
+        if ((ret == 0) && (LIGHTRANGER9_BL_CMD_STAT_READY == status)) {
+            return 0;
+        } else if ((ret != 0) && (ret != -EAGAIN)) {
+            return ret;
+        } else if ((k_uptime_get_32() - start) > LIGHTRANGER9_TIMEOUT) {
+            return -ETIMEDOUT;
+        } else {
+            lightranger9_poll_wait(&delay_us);
         }
-        
-        error_flag |= lightranger9_write_bl_cmd(dev, LIGHTRANGER9_BL_CMD_RAMREMAP_RESET, NULL, 0);
-
-        timeout_cnt = 0;
-        do {
-            k_msleep(1);
-            error_flag |= lightranger9_read_register(dev, LIGHTRANGER9_REG_APPID, data_buf, 1);
-            if (++timeout_cnt > LIGHTRANGER9_TIMEOUT) {
-                return -1;
-            }
-        } while (LIGHTRANGER9_APP_ID_MEASUREMENT != data_buf[ 0 ]);
     }
-
-    return error_flag;
 }
 
-static int lightranger9_clear_interrupts (const struct device *dev)
+static int lightranger9_wait_app_id(const struct device *dev, uint8_t app_id)
 {
-    uint8_t int_status;
-    int error_flag = lightranger9_read_register(dev, LIGHTRANGER9_REG_INT_STATUS, &int_status, 1);
-    error_flag |= lightranger9_write_register(dev, LIGHTRANGER9_REG_INT_STATUS, int_status);
-    return error_flag;
+    uint32_t start = k_uptime_get_32();
+    uint32_t delay_us = BL_POLL_MIN_US;
+    uint8_t id = 0;
+    int ret;
+
+    while (true) {
+        ret = lightranger9_read_register(dev, LIGHTRANGER9_REG_APPID, &id, 1);
+        if ((ret == 0) && (app_id == id)) {
+            return 0;
+        } else if ((k_uptime_get_32() - start) > LIGHTRANGER9_TIMEOUT) {
+            return -ETIMEDOUT;
+        } else {
+            // the sensor may not answer while it resets
+            lightranger9_poll_wait(&delay_us);
+        }
+    }
 }
 
-static int lightranger9_sample_fetch(const struct device *dev,
-                                     enum sensor_channel chan)
+#ifdef CONFIG_LIGHTRANGER9_FW_COMPRESSED
+static uint8_t lightranger9_fw_read(lightranger9_fw_stream_t *fw, uint8_t *dst, uint8_t len)
 {
-    lightranger9_meas_cpt_t *data = dev->data;
-    uint8_t data_buf[LIGHTRANGER9_BLOCKREAD_SIZE] = {0};
-    uint8_t cnt;
-    uint8_t ret;
-
-    ret  = lightranger9_clear_interrupts(dev);
-    ret |= lightranger9_read_register(dev,
-                                      LIGHTRANGER9_REG_BLOCKREAD,
-                                      data_buf,
-                                      LIGHTRANGER9_BLOCKREAD_SIZE);
-
-    if (ret == 0) {
-        data->sub_capture   = data_buf[LIGHTRANGER9_REG_RESULT_NUMBER - LIGHTRANGER9_REG_BLOCKREAD] & LIGHTRANGER9_SUBCAPTURE_MASK;
-        data->result_number = (data_buf[LIGHTRANGER9_REG_RESULT_NUMBER - LIGHTRANGER9_REG_BLOCKREAD] >> 2) & LIGHTRANGER9_RESULT_NUMBER_MASK;
-        data->temperature   = (int8_t)data_buf[LIGHTRANGER9_REG_TEMPERATURE - LIGHTRANGER9_REG_BLOCKREAD];
-        data->valid_results = data_buf[LIGHTRANGER9_REG_NUMBER_VALID_RESULTS - LIGHTRANGER9_REG_BLOCKREAD];
-
-        data->ambient_light = 
-            ((uint32_t)data_buf[LIGHTRANGER9_REG_AMBIENT_LIGHT_3 - LIGHTRANGER9_REG_BLOCKREAD] << 24) | 
-            ((uint32_t)data_buf[LIGHTRANGER9_REG_AMBIENT_LIGHT_2 - LIGHTRANGER9_REG_BLOCKREAD] << 16) | 
-            ((uint16_t)data_buf[LIGHTRANGER9_REG_AMBIENT_LIGHT_1 - LIGHTRANGER9_REG_BLOCKREAD] <<  8) | 
-            data_buf[LIGHTRANGER9_REG_AMBIENT_LIGHT_0 - LIGHTRANGER9_REG_BLOCKREAD];
-
-        data->photon_count = 
-            ((uint32_t)data_buf[LIGHTRANGER9_REG_PHOTON_COUNT_3 - LIGHTRANGER9_REG_BLOCKREAD] << 24) | 
-            ((uint32_t)data_buf[LIGHTRANGER9_REG_PHOTON_COUNT_2 - LIGHTRANGER9_REG_BLOCKREAD] << 16) | 
-            ((uint16_t)data_buf[LIGHTRANGER9_REG_PHOTON_COUNT_1 - LIGHTRANGER9_REG_BLOCKREAD] <<  8) | 
-            data_buf[LIGHTRANGER9_REG_PHOTON_COUNT_0 - LIGHTRANGER9_REG_BLOCKREAD];
-
-        data->reference_count = 
-            (( uint32_t)data_buf[LIGHTRANGER9_REG_REFERENCE_COUNT_3 - LIGHTRANGER9_REG_BLOCKREAD] << 24) | 
-            (( uint32_t)data_buf[LIGHTRANGER9_REG_REFERENCE_COUNT_2 - LIGHTRANGER9_REG_BLOCKREAD] << 16) | 
-            (( uint16_t)data_buf[LIGHTRANGER9_REG_REFERENCE_COUNT_1 - LIGHTRANGER9_REG_BLOCKREAD] <<  8) | 
-            data_buf[LIGHTRANGER9_REG_REFERENCE_COUNT_0 - LIGHTRANGER9_REG_BLOCKREAD];
-
-        data->sys_tick_sec = 
-            ((( uint32_t)data_buf[LIGHTRANGER9_REG_SYS_TICK_3 - LIGHTRANGER9_REG_BLOCKREAD] << 24) | 
-             (( uint32_t)data_buf[LIGHTRANGER9_REG_SYS_TICK_2 - LIGHTRANGER9_REG_BLOCKREAD] << 16) | 
-             (( uint16_t)data_buf[LIGHTRANGER9_REG_SYS_TICK_1 - LIGHTRANGER9_REG_BLOCKREAD] <<  8) | 
-             data_buf[LIGHTRANGER9_REG_SYS_TICK_0 - LIGHTRANGER9_REG_BLOCKREAD ]) * LIGHTRANGER9_SYS_TICK_TO_SEC;
-
-        for (cnt = 0; cnt < LIGHTRANGER9_MAX_MEAS_RESULTS; cnt++) {
-            data->result[cnt].confidence = data_buf[LIGHTRANGER9_REG_RES_CONFIDENCE_0 - LIGHTRANGER9_REG_BLOCKREAD + (cnt * 3)];
-            if (data->result[cnt].confidence >= LIGHTRANGER9_CONFIDENCE_THRESHOLD) {
-                data->result[cnt].distance_mm = 
-                    ((uint16_t)data_buf[LIGHTRANGER9_REG_RES_DISTANCE_0_MSB - LIGHTRANGER9_REG_BLOCKREAD + (cnt * 3)] << 8) | 
-                    data_buf[LIGHTRANGER9_REG_RES_DISTANCE_0_LSB - LIGHTRANGER9_REG_BLOCKREAD + (cnt * 3)];
-            } else {
-                data->result[cnt].distance_mm = 0;
+    uint8_t cnt = 0;
+    uint8_t byte;
+
+    while ((cnt < len) && (fw->src_pos < sizeof(tof_bin_image_lzss))) {
+        if (fw->match_left > 0) {
+            byte = lightranger9_fw_window[(fw->win_pos - fw->match_dist) & (FW_WINDOW_SIZE - 1)];
+            fw->match_left--;
+        } else {
+            if (fw->flag_cnt == 0) {
+                fw->flags = tof_bin_image_lzss[fw->src_pos++];
+                fw->flag_cnt = 8;
+                continue;
+            }
+
+            fw->flag_cnt--;
+            if (fw->flags & 0x01) {
+                // back reference, needs both bytes
+                if ((fw->src_pos + 2) > sizeof(tof_bin_image_lzss)) {
+                    break;
+                }
+                fw->match_dist = (tof_bin_image_lzss[fw->src_pos] |
+                                  ((tof_bin_image_lzss[fw->src_pos + 1] >> FW_LEN_BITS) << 8)) + 1;
+                fw->match_left = (tof_bin_image_lzss[fw->src_pos + 1] & ((1 << FW_LEN_BITS) - 1)) +
+                                 TOF_BIN_IMAGE_LZSS_MIN_MATCH;
+                fw->src_pos += 2;
+                fw->flags >>= 1;
+                continue;
             }
+
+            byte = tof_bin_image_lzss[fw->src_pos++];
+            fw->flags >>= 1;
         }
-        return 0;
-    }
 
-    return -1;
-}
+        lightranger9_fw_window[fw->win_pos] = byte;
+        fw->win_pos = (fw->win_pos + 1) & (FW_WINDOW_SIZE - 1);
+        dst[cnt++] = byte;
+    }
 
-static int lightranger9_channel_get(const struct device *dev,
-                                    enum sensor_channel chan,
-                                    struct sensor_value *val)
-{
-    // Does nothing
+    /**
+     * Finish a back reference running past the end of the stream
+     */
+    while ((cnt < len) && (fw->match_left > 0)) {
+        byte = lightranger9_fw_window[(fw->win_pos - fw->match_dist) & (FW_WINDOW_SIZE - 1)];
+        fw->match_left--;
+        lightranger9_fw_window[fw->win_pos] = byte;
+        fw->win_pos = (fw->win_pos + 1) & (FW_WINDOW_SIZE - 1);
+        dst[cnt++] = byte;
+    }
 
-    return 0;
+    return cnt;
 }
+#endif /* CONFIG_LIGHTRANGER9_FW_COMPRESSED */
 
-static int lightranger9_enable_device(const struct device *dev)
+static int lightranger9_download_fw_bin(const struct device *dev)
 {
-    const lightranger9_config_t *cfg = dev->config;
-    int ret;
+    lightranger9_data_t *data = dev->data;
+    uint8_t *payload = &data->tx_buf[3];
+    uint32_t start_ms    = k_uptime_get_32();
+    uint32_t fw_index    = 0;
+    uint8_t chunk_bytes  = 0;
+    uint8_t app_id       = 0;
+    int ret;
+#ifdef CONFIG_LIGHTRANGER9_FW_COMPRESSED
+    lightranger9_fw_stream_t fw = {0};
+#endif
+
+    ret = lightranger9_read_register(dev, LIGHTRANGER9_REG_APPID, &app_id, 1);
+    if ((ret != 0) || (LIGHTRANGER9_APP_ID_BOOTLOADER != app_id)) {
+        return ret;
+    }
+
+    // the payload is staged in tx_buf, keep it ours for the whole download
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+#ifdef CONFIG_LIGHTRANGER9_FW_COMPRESSED
+    k_mutex_lock(&lightranger9_fw_lock, K_FOREVER);
+#endif
+
+    payload[0] = BL_DOWNLOAD_INIT_SEED;
+    ret = lightranger9_write_bl_frame(dev, LIGHTRANGER9_BL_CMD_DOWNLOAD_INIT, 1);
+    if (ret == 0) {
+        ret = lightranger9_wait_bl_ready(dev);
+    }
+
+    if (ret == 0) {
+        payload[0] = BL_START_ADDRESS & 0xFF;
+        payload[1] = (BL_START_ADDRESS >> 8) & 0xFF;
+        ret = lightranger9_write_bl_frame(dev, LIGHTRANGER9_BL_CMD_ADDR_RAM, 2);
+    }
+    if (ret == 0) {
+        ret = lightranger9_wait_bl_ready(dev);
+    }
+
+    while ((ret == 0) && (fw_index < TOF_BIN_IMAGE_SIZE)) {
+        chunk_bytes = MIN(BL_MAX_CHUNK_BYTES, TOF_BIN_IMAGE_SIZE - fw_index);
+
+#ifdef CONFIG_LIGHTRANGER9_FW_COMPRESSED
+        // decode the next chunk straight into the frame payload
+        if (lightranger9_fw_read(&fw, payload, chunk_bytes) != chunk_bytes) {
+            ret = -EILSEQ;
+            break;
+        }
+#else
+        memcpy(payload, &tof_bin_image[fw_index], chunk_bytes);
+#endif
+        ret = lightranger9_write_bl_frame(dev, LIGHTRANGER9_BL_CMD_W_RAM, chunk_bytes);
+        if (ret == 0) {
+            ret = lightranger9_wait_bl_ready(dev);
+        }
+        fw_index += chunk_bytes;
+    }
+
+    if (ret == 0) {
+        ret = lightranger9_write_bl_frame(dev, LIGHTRANGER9_BL_CMD_RAMREMAP_RESET, 0);
+    }
+    if (ret == 0) {
+        ret = lightranger9_wait_app_id(dev, LIGHTRANGER9_APP_ID_MEASUREMENT);
+    }
+
+#ifdef CONFIG_LIGHTRANGER9_FW_COMPRESSED
+    k_mutex_unlock(&lightranger9_fw_lock);
+#endif
+    k_mutex_unlock(&data->cmd_lock);
+
+    if (ret == 0) {
+        data->fw_download_ms = k_uptime_get_32() - start_ms;
+        LOG_INF("Firmware downloaded in %u ms (%u bytes)",
+                data->fw_download_ms,
+                (uint32_t)TOF_BIN_IMAGE_SIZE);
+    } else {
+        LOG_ERR("Firmware download failed at offset %u (%d)!", fw_index, ret);
+    }
+
+    return ret;
+}
+#endif /* CONFIG_LIGHTRANGER9_REPLAY */
+
+static int lightranger9_clear_interrupts (const struct device *dev)
+{
+    uint8_t int_status;
+    int error_flag = lightranger9_read_register(dev, LIGHTRANGER9_REG_INT_STATUS, &int_status, 1);
+    error_flag |= lightranger9_write_register(dev, LIGHTRANGER9_REG_INT_STATUS, int_status);
+    return error_flag;
+}
+
+static int lightranger9_send_cmd(const struct device *dev, uint8_t cmd)
+{
+    uint32_t start = k_uptime_get_32();
+    uint32_t delay_us = BL_POLL_MIN_US;
+    uint8_t status = cmd;
+    int ret;
+
+    ret = lightranger9_write_register(dev, LIGHTRANGER9_REG_CMD_STAT, cmd);
+
+    /**
+     * CMD_STAT reads back the command while it is executing
+     * and a status code below 0x10 once it is done.
+     */
+    while (ret == 0) {
+        ret = lightranger9_read_register(dev, LIGHTRANGER9_REG_CMD_STAT, &status, 1);
+        if ((ret == 0) && (status < CMD_STAT_STATUS_LIMIT)) {
+            if ((status == LIGHTRANGER9_CMD_STAT_OK) ||
+                (status == LIGHTRANGER9_CMD_STAT_ACCEPTED)) {
+                return 0;
+            }
+            LOG_ERR("Command 0x%02X failed with status 0x%02X!", cmd, status);
+            return -EIO;
+        } else if ((k_uptime_get_32() - start) > LIGHTRANGER9_TIMEOUT) {
+            return -ETIMEDOUT;
+        } else {
+            lightranger9_poll_wait(&delay_us);
+        }
+    }
+
+    return ret;
+}
+
+static int lightranger9_start_measurement(const struct device *dev)
+{
+    uint8_t int_enab = LIGHTRANGER9_INT_ENAB_MEAS_READY;
+    int error_flag = 0;
+
+#ifdef CONFIG_LIGHTRANGER9_HISTOGRAMS
+    lightranger9_data_t *data = dev->data;
+
+    if (data->hist_enabled) {
+        int_enab |= LIGHTRANGER9_INT_ENAB_HIST_READY;
+    } else {
+        // do nothing
+    }
+#endif
+
+    //Enable measurement ready interrupt, start measurement and clear interrupts
+    error_flag |= lightranger9_write_register(dev,
+                                              LIGHTRANGER9_REG_INT_ENAB,
+                                              int_enab);
+    error_flag |= lightranger9_write_register(dev,
+                                              LIGHTRANGER9_REG_CONFIG_RESULT,
+                                              LIGHTRANGER9_CONFIG_RESULT_MEAS);
+    error_flag |= lightranger9_write_register(dev,
+                                              LIGHTRANGER9_REG_CMD_STAT,
+                                              LIGHTRANGER9_CMD_STAT_MEASURE);
+    error_flag |= lightranger9_clear_interrupts(dev);
+
+    return error_flag;
+}
+
+static int lightranger9_read_capture(const struct device *dev, uint8_t *block,
+                                     uint16_t *kilo_iterations)
+{
+    lightranger9_data_t *data = dev->data;
+    int ret;
+
+#ifdef CONFIG_LIGHTRANGER9_REPLAY
+    uint8_t zone_mode = data->zone_mode;
+
+    ret = lightranger9_replay_read(dev, block, &zone_mode);
+    if ((ret == 0) && (zone_mode != data->zone_mode) &&
+        (zone_mode < ARRAY_SIZE(lightranger9_zone_layouts))) {
+        // decode with the layout the capture was recorded in
+        data->zone_mode = zone_mode;
+        lightranger9_frame_reset(data);
+    } else {
+        // do nothing
+    }
+    *kilo_iterations = data->kilo_iterations;
+#else
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+
+    ret = lightranger9_clear_interrupts(dev);
+    if (ret == 0) {
+        ret = lightranger9_read_register(dev,
+                                         LIGHTRANGER9_REG_BLOCKREAD,
+                                         block,
+                                         LIGHTRANGER9_BLOCKREAD_SIZE);
+    } else {
+        // do nothing
+    }
+
+    if ((ret == 0) && (block[0] != LIGHTRANGER9_CONFIG_RESULT_MEAS)) {
+        // not a result page, e.g. the sensor was reset meanwhile
+        ret = -EBADMSG;
+    } else {
+        // do nothing
+    }
+
+    // taken under cmd_lock, so a reconfiguration cannot slip in between
+    *kilo_iterations = data->kilo_iterations;
+
+#ifdef CONFIG_LIGHTRANGER9_RECORD
+    if (ret == 0) {
+        lightranger9_record_write(dev, block);
+    } else {
+        // do nothing
+    }
+#endif
+
+    k_mutex_unlock(&data->cmd_lock);
+#endif /* CONFIG_LIGHTRANGER9_REPLAY */
+
+    return ret;
+}
+
+static void lightranger9_decode_capture(const uint8_t *data_buf,
+                                        const lightranger9_zone_layout_t *layout,
+                                        uint8_t confidence_threshold,
+                                        lightranger9_meas_cpt_t *data)
+{
+    uint8_t cnt;
+
+    data->sub_capture   = lightranger9_result_slot(layout,
+                                                   data_buf[LIGHTRANGER9_REG_RESULT_NUMBER - LIGHTRANGER9_REG_BLOCKREAD],
+                                                   &data->result_number);
+    data->temperature   = (int8_t)data_buf[LIGHTRANGER9_REG_TEMPERATURE - LIGHTRANGER9_REG_BLOCKREAD];
+    data->valid_results = data_buf[LIGHTRANGER9_REG_NUMBER_VALID_RESULTS - LIGHTRANGER9_REG_BLOCKREAD];
+
+    data->ambient_light = 
+        ((uint32_t)data_buf[LIGHTRANGER9_REG_AMBIENT_LIGHT_3 - LIGHTRANGER9_REG_BLOCKREAD] << 24) | 
+        ((uint32_t)data_buf[LIGHTRANGER9_REG_AMBIENT_LIGHT_2 - LIGHTRANGER9_REG_BLOCKREAD] << 16) | 
+        ((uint16_t)data_buf[LIGHTRANGER9_REG_AMBIENT_LIGHT_1 - LIGHTRANGER9_REG_BLOCKREAD] <<  8) | 
+        data_buf[LIGHTRANGER9_REG_AMBIENT_LIGHT_0 - LIGHTRANGER9_REG_BLOCKREAD];
+
+    data->photon_count = 
+        ((uint32_t)data_buf[LIGHTRANGER9_REG_PHOTON_COUNT_3 - LIGHTRANGER9_REG_BLOCKREAD] << 24) | 
+        ((uint32_t)data_buf[LIGHTRANGER9_REG_PHOTON_COUNT_2 - LIGHTRANGER9_REG_BLOCKREAD] << 16) | 
+        ((uint16_t)data_buf[LIGHTRANGER9_REG_PHOTON_COUNT_1 - LIGHTRANGER9_REG_BLOCKREAD] <<  8) | 
+        data_buf[LIGHTRANGER9_REG_PHOTON_COUNT_0 - LIGHTRANGER9_REG_BLOCKREAD];
+
+    data->reference_count = 
+        (( uint32_t)data_buf[LIGHTRANGER9_REG_REFERENCE_COUNT_3 - LIGHTRANGER9_REG_BLOCKREAD] << 24) | 
+        (( uint32_t)data_buf[LIGHTRANGER9_REG_REFERENCE_COUNT_2 - LIGHTRANGER9_REG_BLOCKREAD] << 16) | 
+        (( uint16_t)data_buf[LIGHTRANGER9_REG_REFERENCE_COUNT_1 - LIGHTRANGER9_REG_BLOCKREAD] <<  8) | 
+        data_buf[LIGHTRANGER9_REG_REFERENCE_COUNT_0 - LIGHTRANGER9_REG_BLOCKREAD];
+
+    data->sys_tick_sec = 
+        ((( uint32_t)data_buf[LIGHTRANGER9_REG_SYS_TICK_3 - LIGHTRANGER9_REG_BLOCKREAD] << 24) | 
+         (( uint32_t)data_buf[LIGHTRANGER9_REG_SYS_TICK_2 - LIGHTRANGER9_REG_BLOCKREAD] << 16) | 
+         (( uint16_t)data_buf[LIGHTRANGER9_REG_SYS_TICK_1 - LIGHTRANGER9_REG_BLOCKREAD] <<  8) | 
+         data_buf[LIGHTRANGER9_REG_SYS_TICK_0 - LIGHTRANGER9_REG_BLOCKREAD ]) * LIGHTRANGER9_SYS_TICK_TO_SEC;
+
+    for (cnt = 0; cnt < LIGHTRANGER9_MAX_MEAS_RESULTS; cnt++) {
+        data->result[cnt].confidence = data_buf[LIGHTRANGER9_REG_RES_CONFIDENCE_0 - LIGHTRANGER9_REG_BLOCKREAD + (cnt * 3)];
+        if (data->result[cnt].confidence >= confidence_threshold) {
+            data->result[cnt].distance_mm = 
+                ((uint16_t)data_buf[LIGHTRANGER9_REG_RES_DISTANCE_0_MSB - LIGHTRANGER9_REG_BLOCKREAD + (cnt * 3)] << 8) | 
+                data_buf[LIGHTRANGER9_REG_RES_DISTANCE_0_LSB - LIGHTRANGER9_REG_BLOCKREAD + (cnt * 3)];
+        } else {
+            data->result[cnt].distance_mm = 0;
+        }
+    }
+}
+
+#ifdef CONFIG_LIGHTRANGER9_HISTOGRAMS
+BUILD_ASSERT(sizeof(lightranger9_hist_packet_t) == LIGHTRANGER9_HIST_PACKET_SIZE,
+             "histogram packets are read from the bus as is");
+
+static int lightranger9_acquire_hist(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    lightranger9_hist_packet_t *slot;
+    k_spinlock_key_t key;
+    bool full;
+    int ret;
+
+    key = k_spin_lock(&data->lock);
+    full = (data->hist_head - data->hist_tail) >= CONFIG_LIGHTRANGER9_HIST_RING_SIZE;
+    data->hist_stalled = full;
+    k_spin_unlock(&data->lock, key);
+
+    if (full) {
+        /**
+         * Leave HIST_READY set, the sensor waits for it to be cleared
+         * before it produces anything else, so no packet is lost.
+         */
+        data->hist_stalls++;
+        return -ENOBUFS;
+    }
+
+    // the slot is not visible to the consumer until hist_head moves
+    slot = &data->hist_ring[data->hist_head % CONFIG_LIGHTRANGER9_HIST_RING_SIZE];
+
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+    ret = lightranger9_read_register(dev,
+                                     LIGHTRANGER9_REG_CONFIG_RESULT,
+                                     (uint8_t *)slot,
+                                     LIGHTRANGER9_HIST_PACKET_SIZE);
+    if (ret == 0) {
+        ret = lightranger9_write_register(dev,
+                                          LIGHTRANGER9_REG_INT_STATUS,
+                                          LIGHTRANGER9_INT_STATUS_HIST_READY);
+    } else {
+        // do nothing
+    }
+    k_mutex_unlock(&data->cmd_lock);
+
+    if ((ret == 0) && (slot->cid == LIGHTRANGER9_CONFIG_RESULT_HIST_RAW_CID)) {
+        key = k_spin_lock(&data->lock);
+        data->hist_head++;
+        k_spin_unlock(&data->lock, key);
+        k_sem_give(&data->hist_sem);
+    } else if (ret) {
+        LOG_ERR("Failed to read histogram (%d)!", ret);
+        return ret;
+    } else {
+        LOG_WRN("Unexpected histogram packet id 0x%02X", slot->cid);
+    }
+
+    // a histogram is not a capture, there is nothing to fetch
+    return -EAGAIN;
+}
+
+int lightranger9_hist_get(const struct device *dev,
+                          lightranger9_hist_packet_t *packet,
+                          k_timeout_t timeout)
+{
+    lightranger9_data_t *data = dev->data;
+    k_spinlock_key_t key;
+    bool stalled;
+
+    if (k_sem_take(&data->hist_sem, timeout)) {
+        return -EAGAIN;
+    }
+
+    memcpy(packet,
+           &data->hist_ring[data->hist_tail % CONFIG_LIGHTRANGER9_HIST_RING_SIZE],
+           sizeof(lightranger9_hist_packet_t));
+
+    key = k_spin_lock(&data->lock);
+    data->hist_tail++;
+    stalled = data->hist_stalled;
+    data->hist_stalled = false;
+    k_spin_unlock(&data->lock, key);
+
+    if (stalled) {
+        lightranger9_trigger_kick(dev);
+    } else {
+        // do nothing
+    }
+
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_TRIGGER
+int lightranger9_acquire_capture(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    k_spinlock_key_t key;
+    uint8_t *block;
+    uint16_t kilo_iterations;
+    uint8_t int_status = 0;
+    int ret;
+
+    /**
+     * The same falling edge can be signalled twice, by the GPIO callback
+     * and by lightranger9_trigger_kick(). Only read what the sensor says
+     * is ready, anything else it raised is just cleared to release INT.
+     */
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+    ret = lightranger9_read_register(dev, LIGHTRANGER9_REG_INT_STATUS, &int_status, 1);
+    if ((ret == 0) && (int_status != 0) &&
+        !(int_status & (LIGHTRANGER9_INT_STATUS_MEAS_READY | LIGHTRANGER9_INT_STATUS_HIST_READY))) {
+        ret = lightranger9_write_register(dev, LIGHTRANGER9_REG_INT_STATUS, int_status);
+    } else {
+        // do nothing
+    }
+    k_mutex_unlock(&data->cmd_lock);
+
+    if (ret) {
+        LOG_ERR("Failed to read interrupt status (%d)!", ret);
+        return lightranger9_recover(dev, ret);
+    }
+
+#ifdef CONFIG_LIGHTRANGER9_HISTOGRAMS
+    if (data->hist_enabled && (int_status & LIGHTRANGER9_INT_STATUS_HIST_READY)) {
+        return lightranger9_acquire_hist(dev);
+    } else {
+        // do nothing
+    }
+#endif
+
+    if (!(int_status & LIGHTRANGER9_INT_STATUS_MEAS_READY)) {
+        return -ENODATA;
+    }
+
+    key = k_spin_lock(&data->lock);
+    if (data->fifo_count < LIGHTRANGER9_FIFO_DEPTH) {
+        block = data->fifo_block[data->fifo_head];
+    } else {
+        block = NULL;
+    }
+    k_spin_unlock(&data->lock, key);
+
+    if (block == NULL) {
+        /**
+         * The consumer fell behind, drop the new capture but release
+         * the sensor so it keeps measuring.
+         */
+        data->fifo_stats.overflows++;
+        k_mutex_lock(&data->cmd_lock, K_FOREVER);
+        ret = lightranger9_clear_interrupts(dev);
+        k_mutex_unlock(&data->cmd_lock);
+        return (ret == 0) ? -EAGAIN : ret;
+    }
+
+    ret = lightranger9_read_capture(dev, block, &kilo_iterations);
+
+    if (ret == 0) {
+#ifdef CONFIG_LIGHTRANGER9_ADAPTIVE_ITERATIONS
+        // before the slot is handed over, the consumer may reuse it after
+        lightranger9_apply_iterations(dev, block);
+#endif
+        key = k_spin_lock(&data->lock);
+        data->fifo_stamp[data->fifo_head] = data->int_stamp;
+        data->fifo_kilo[data->fifo_head] = kilo_iterations;
+        data->fifo_head = (data->fifo_head + 1) % LIGHTRANGER9_FIFO_DEPTH;
+        data->fifo_count++;
+        data->fifo_stats.high_water = MAX(data->fifo_stats.high_water, data->fifo_count);
+        k_spin_unlock(&data->lock, key);
+    } else {
+        LOG_ERR("Failed to read capture (%d)!", ret);
+        ret = lightranger9_recover(dev, ret);
+    }
+
+    return ret;
+}
+
+int lightranger9_retry_recovery(const struct device *dev)
+{
+    return lightranger9_recover(dev, 0);
+}
+#endif
+
+static int lightranger9_sample_fetch(const struct device *dev,
+                                     enum sensor_channel chan)
+{
+    lightranger9_data_t *data = dev->data;
+    k_spinlock_key_t key;
+    uint32_t recovery_ms;
+    int ret = 0;
+
+    key = k_spin_lock(&data->lock);
+    if (data->fifo_claimed) {
+        // hand the previously fetched slot back to the trigger thread
+        data->fifo_tail = (data->fifo_tail + 1) % LIGHTRANGER9_FIFO_DEPTH;
+        data->fifo_count--;
+        data->fifo_claimed = false;
+    } else {
+        // do nothing
+    }
+
+    if (data->fifo_count > 0) {
+        data->read_block = data->fifo_block[data->fifo_tail];
+        data->read_stamp = data->fifo_stamp[data->fifo_tail];
+        data->read_kilo = data->fifo_kilo[data->fifo_tail];
+        data->fifo_claimed = true;
+        k_spin_unlock(&data->lock, key);
+    } else {
+        k_spin_unlock(&data->lock, key);
+#ifdef CONFIG_LIGHTRANGER9_TRIGGER
+        if (data->drdy_handler != NULL) {
+            return -ENODATA;
+        }
+#endif
+        // nothing is queued without a trigger, read the slot directly
+        data->read_block = data->fifo_block[data->fifo_tail];
+        data->read_stamp = k_cycle_get_32();
+        ret = lightranger9_read_capture(dev, data->read_block, &data->read_kilo);
+        if (ret) {
+            LOG_ERR("Failed to read capture (%d)!", ret);
+            ret = lightranger9_recover(dev, ret);
+        } else {
+            // do nothing
+        }
+    }
+
+    /**
+     * The capture stays raw in read_block, it is decoded straight into
+     * the caller's structure by lightranger9_decode_frame().
+     */
+    if (ret == 0) {
+        if (data->boot_to_first_frame_ms == 0) {
+            data->boot_to_first_frame_ms = k_uptime_get_32() - data->init_start_ms;
+            LOG_INF("Boot to first frame: %u ms (firmware download %u ms)",
+                    data->boot_to_first_frame_ms,
+                    data->fw_download_ms);
+        } else {
+            // do nothing
+        }
+
+        key = k_spin_lock(&data->lock);
+        if (data->fault_ms != 0) {
+            recovery_ms = k_uptime_get_32() - data->fault_ms;
+            data->fault_stats.last_recovery_ms = recovery_ms;
+            data->fault_stats.max_recovery_ms = MAX(data->fault_stats.max_recovery_ms, recovery_ms);
+            data->fault_ms = 0;
+        } else {
+            recovery_ms = 0;
+        }
+        k_spin_unlock(&data->lock, key);
+
+        if (recovery_ms != 0) {
+            LOG_INF("Fault to first frame: %u ms", recovery_ms);
+        } else {
+            // do nothing
+        }
+    } else if (ret != -EAGAIN) {
+        ret = -EIO;
+    } else {
+        // recovered, the next capture is on its way
+    }
+
+    return ret;
+}
+
+#ifdef CONFIG_LIGHTRANGER9_TRIGGER
+bool lightranger9_fifo_drain(const struct device *dev,
+                             lightranger9_measurement_t *frame,
+                             uint32_t *timestamp)
+{
+    lightranger9_data_t *data = dev->data;
+
+    // without a trigger nothing is queued and every fetch reads the bus
+    if (data->drdy_handler == NULL) {
+        return false;
+    }
+
+    while (lightranger9_sample_fetch(dev, SENSOR_CHAN_ALL) == 0) {
+        if (lightranger9_decode_frame(dev, frame)) {
+            if (timestamp != NULL) {
+                *timestamp = data->read_stamp;
+            } else {
+                // do nothing
+            }
+            return true;
+        } else {
+            // do nothing
+        }
+    }
+
+    return false;
+}
+#endif
+
+static int lightranger9_write_cfg_common(const struct device *dev,
+                                         uint8_t reg,
+                                         uint8_t *data_in,
+                                         uint8_t len)
+{
+    int ret;
+
+    /**
+     * Only the common config page is touched: stop, load the page,
+     * patch the registers and write the page back. The caller holds
+     * cmd_lock and restarts the measurement.
+     */
+    ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_STOP);
+    if (ret == 0) {
+        ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_LOAD_CFG_PAGE_COMMON);
+    }
+    if (ret == 0) {
+        ret = lightranger9_generic_write(dev, reg, data_in, len);
+    }
+    if (ret == 0) {
+        ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_WRITE_CFG_PAGE);
+    }
+
+    return ret;
+}
+
+static int lightranger9_set_period(const struct device *dev, uint16_t period_ms)
+{
+    lightranger9_data_t *data = dev->data;
+    uint8_t period[2] = { period_ms & 0xFF, (period_ms >> 8) & 0xFF };
+    int ret;
+
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+
+    ret = lightranger9_write_cfg_common(dev, LIGHTRANGER9_REG_PERIOD_MS_LSB, period, sizeof(period));
+    if (ret == 0) {
+        data->period_ms = period_ms;
+    } else {
+        LOG_ERR("Failed to set measurement period (%d)!", ret);
+    }
+
+    /**
+     * Restart measurements with whichever period is now active. The
+     * result numbers start over, so a partly assembled frame cannot be
+     * completed by the sub-captures that follow.
+     */
+    lightranger9_frame_reset(data);
+    ret |= lightranger9_start_measurement(dev);
+
+    k_mutex_unlock(&data->cmd_lock);
+
+    return ret;
+}
+
+static int lightranger9_write_kilo_iterations(const struct device *dev, uint16_t kilo_iterations)
+{
+    lightranger9_data_t *data = dev->data;
+    uint8_t iterations[2] = { kilo_iterations & 0xFF, (kilo_iterations >> 8) & 0xFF };
+    int ret;
+
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+
+    ret = lightranger9_write_cfg_common(dev, LIGHTRANGER9_REG_KILO_ITERATIONS_LSB,
+                                        iterations, sizeof(iterations));
+    if (ret == 0) {
+        data->kilo_iterations = kilo_iterations;
+    } else {
+        LOG_ERR("Failed to set kilo iterations (%d)!", ret);
+    }
+
+    ret |= lightranger9_start_measurement(dev);
+
+    k_mutex_unlock(&data->cmd_lock);
+
+    return ret;
+}
+
+static int lightranger9_set_kilo_iterations(const struct device *dev, uint16_t kilo_iterations)
+{
+    lightranger9_data_t *data = dev->data;
+
+#ifdef CONFIG_LIGHTRANGER9_ADAPTIVE_ITERATIONS
+    // an explicit setting overrides a pending adaptation
+    data->iter_target = 0;
+#endif
+    // captures in flight were taken with the old setting
+    lightranger9_frame_reset(data);
+
+    return lightranger9_write_kilo_iterations(dev, kilo_iterations);
+}
+
+#ifdef CONFIG_LIGHTRANGER9_ADAPTIVE_ITERATIONS
+/**
+ * Zones of confidence lost against the reference before integrating longer,
+ * and consecutive strong frames before integrating shorter.
+ */
+#define ITER_DROP_MARGIN        2
+#define ITER_HOLD_FRAMES        4
+
+BUILD_ASSERT(CONFIG_LIGHTRANGER9_ITERATIONS_MIN <= CONFIG_LIGHTRANGER9_ITERATIONS_MAX,
+             "Minimum kilo iterations above the maximum");
+
+static void lightranger9_adapt_iterations(const struct device *dev,
+                                          const lightranger9_measurement_t *frame)
+{
+    lightranger9_data_t *data = dev->data;
+    uint16_t kilo_iterations = data->kilo_iterations;
+    uint32_t confidence_sum = 0;
+    uint8_t valid = 0;
+    uint8_t i;
+
+    /**
+     * No reference photons means the laser did not fire, and frames
+     * measured before the last change, or while one is still pending,
+     * do not show its effect yet. Neither has anything to learn from.
+     */
+    if ((frame->reference_count == 0) || (data->iter_target != 0) ||
+        (frame->kilo_iterations != data->kilo_iterations)) {
+        return;
+    }
+
+    for (i = 0; i < frame->zones; i++) {
+        if (frame->obj1[i].confidence >= data->confidence_threshold) {
+            confidence_sum += frame->obj1[i].confidence;
+            valid++;
+        }
+    }
+
+    /**
+     * Extend as soon as zones fall below the threshold, the new count
+     * becomes the reference so a changed scene does not keep us at the
+     * maximum. Shorten only while every confident zone keeps headroom
+     * on average and the return signal outweighs the ambient light.
+     */
+    if ((valid + ITER_DROP_MARGIN) < data->iter_valid_ref) {
+        kilo_iterations = MIN(kilo_iterations + (kilo_iterations / 4),
+                              CONFIG_LIGHTRANGER9_ITERATIONS_MAX);
+        data->iter_valid_ref = valid;
+        data->iter_strong_frames = 0;
+    } else {
+        data->iter_valid_ref = MAX(data->iter_valid_ref, valid);
+
+        if ((valid > 0) &&
+            ((confidence_sum / valid) >= (data->confidence_threshold + CONFIG_LIGHTRANGER9_ITERATIONS_HEADROOM)) &&
+            (frame->photon_count > frame->ambient_light)) {
+            data->iter_strong_frames++;
+        } else {
+            data->iter_strong_frames = 0;
+        }
+
+        if (data->iter_strong_frames >= ITER_HOLD_FRAMES) {
+            kilo_iterations = MAX(kilo_iterations - (kilo_iterations / 8),
+                                  CONFIG_LIGHTRANGER9_ITERATIONS_MIN);
+            data->iter_strong_frames = 0;
+        } else {
+            // do nothing
+        }
+    }
+
+    if (kilo_iterations != data->kilo_iterations) {
+        LOG_DBG("Kilo iterations %d -> %d (%d valid zones)",
+                data->kilo_iterations, kilo_iterations, valid);
+        // reconfiguring blocks, leave it to the trigger thread
+        data->iter_target = kilo_iterations;
+    } else {
+        // do nothing
+    }
+}
+
+static void lightranger9_apply_iterations(const struct device *dev, const uint8_t *block)
+{
+    lightranger9_data_t *data = dev->data;
+    const lightranger9_zone_layout_t *layout = &lightranger9_zone_layouts[data->zone_mode];
+    uint16_t target = data->iter_target;
+    uint8_t rn;
+
+    /**
+     * Restart the measurement only once the sensor delivered the last
+     * sub-capture of a frame, so no sub-capture in flight is lost.
+     * Queued captures keep the setting they were read with.
+     */
+    if ((target == 0) ||
+        (lightranger9_result_slot(layout, block[BLOCK_OFFSET(LIGHTRANGER9_REG_RESULT_NUMBER)], &rn) !=
+         (layout->sub_captures - 1))) {
+        return;
+    }
+
+    lightranger9_write_kilo_iterations(dev, target);
+    data->iter_target = 0;
+}
+#endif /* CONFIG_LIGHTRANGER9_ADAPTIVE_ITERATIONS */
+
+#ifdef CONFIG_LIGHTRANGER9_HISTOGRAMS
+static int lightranger9_set_histograms(const struct device *dev, bool enable)
+{
+    lightranger9_data_t *data = dev->data;
+    uint8_t hist_dump = enable ? LIGHTRANGER9_HIST_DUMP_RAW : LIGHTRANGER9_HIST_DUMP_OFF;
+    int ret;
+
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+
+    ret = lightranger9_write_cfg_common(dev, LIGHTRANGER9_REG_HIST_DUMP, &hist_dump, 1);
+    if (ret == 0) {
+        data->hist_enabled = enable;
+    } else {
+        LOG_ERR("Failed to set histogram readout (%d)!", ret);
+    }
+
+    ret |= lightranger9_start_measurement(dev);
+
+    k_mutex_unlock(&data->cmd_lock);
+
+    return ret;
+}
+#endif
+
+static int lightranger9_apply_zone_mode(const struct device *dev, uint8_t mode)
+{
+    lightranger9_data_t *data = dev->data;
+    const lightranger9_zone_layout_t *layout = &lightranger9_zone_layouts[mode];
+    uint8_t timing[4] = { data->period_ms & 0xFF, (data->period_ms >> 8) & 0xFF,
+                          data->kilo_iterations & 0xFF, (data->kilo_iterations >> 8) & 0xFF };
+    uint8_t spad_map_id = layout->spad_map_id;
+    int ret;
+
+    /**
+     * Switching between TMF8828 and TMF8820 operation resets the
+     * configuration, period and iterations are restored afterwards.
+     * All fields are patched into one load of the common page and
+     * written back together, so the sensor never runs with only some
+     * of them updated. The caller holds cmd_lock and restarts the
+     * measurement.
+     */
+    ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_STOP);
+    if (ret == 0) {
+        ret = lightranger9_send_cmd(dev, layout->mode_cmd);
+    }
+    if (ret == 0) {
+        ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_LOAD_CFG_PAGE_COMMON);
+    }
+    if ((ret == 0) && (mode != LIGHTRANGER9_ZONE_MODE_8X8)) {
+        ret = lightranger9_generic_write(dev, LIGHTRANGER9_REG_SPAD_MAP_ID, &spad_map_id, 1);
+    }
+    if (ret == 0) {
+        ret = lightranger9_generic_write(dev, LIGHTRANGER9_REG_PERIOD_MS_LSB, timing, sizeof(timing));
+    }
+#ifdef CONFIG_LIGHTRANGER9_HISTOGRAMS
+    if ((ret == 0) && data->hist_enabled) {
+        uint8_t hist_dump = LIGHTRANGER9_HIST_DUMP_RAW;
+
+        ret = lightranger9_generic_write(dev, LIGHTRANGER9_REG_HIST_DUMP, &hist_dump, 1);
+    }
+#endif
+    if (ret == 0) {
+        ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_WRITE_CFG_PAGE);
+    }
+#ifdef CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION
+    // the stored pages only apply to the 8x8 SPAD configurations
+    if ((ret == 0) && (mode == LIGHTRANGER9_ZONE_MODE_8X8)) {
+        ret = lightranger9_load_calibration(dev);
+    }
+#endif
+
+    return ret;
+}
+
+static int lightranger9_set_zone_mode(const struct device *dev, uint8_t mode)
+{
+    lightranger9_data_t *data = dev->data;
+    int ret;
+
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+
+    ret = lightranger9_apply_zone_mode(dev, mode);
+    if (ret == 0) {
+        data->zone_mode = mode;
+    } else {
+        LOG_ERR("Failed to set zone mode %d (%d)!", mode, ret);
+    }
+
+    // a frame in assembly is of the old layout
+    lightranger9_frame_reset(data);
+    ret |= lightranger9_start_measurement(dev);
+
+    k_mutex_unlock(&data->cmd_lock);
+
+    return ret;
+}
+
+static int lightranger9_attr_set(const struct device *dev,
+                                 enum sensor_channel chan,
+                                 enum sensor_attribute attr,
+                                 const struct sensor_value *val)
+{
+    lightranger9_data_t *data = dev->data;
+    int64_t freq_uhz;
+    int64_t period_ms;
+
+    if ((int)attr == LIGHTRANGER9_SENSOR_ATTR_CONFIDENCE_THRESHOLD) {
+        if ((val->val1 < 0) || (val->val1 > UINT8_MAX)) {
+            return -EINVAL;
+        }
+        // applied by the driver on the next decoded capture
+        data->confidence_threshold = val->val1;
+        return 0;
+#ifdef CONFIG_LIGHTRANGER9_HISTOGRAMS
+    } else if ((int)attr == LIGHTRANGER9_SENSOR_ATTR_HISTOGRAMS) {
+        return lightranger9_set_histograms(dev, val->val1 != 0);
+#endif
+    } else if ((int)attr == LIGHTRANGER9_SENSOR_ATTR_ZONE_MODE) {
+        if ((val->val1 < 0) || (val->val1 >= ARRAY_SIZE(lightranger9_zone_layouts))) {
+            return -EINVAL;
+        }
+        return lightranger9_set_zone_mode(dev, val->val1);
+    } else if ((int)attr == LIGHTRANGER9_SENSOR_ATTR_KILO_ITERATIONS) {
+        if ((val->val1 < 1) || (val->val1 > UINT16_MAX)) {
+            return -EINVAL;
+        }
+        return lightranger9_set_kilo_iterations(dev, val->val1);
+    } else if (attr == SENSOR_ATTR_SAMPLING_FREQUENCY) {
+        freq_uhz = ((int64_t)val->val1 * 1000000) + val->val2;
+        if (freq_uhz <= 0) {
+            return -EINVAL;
+        }
+        period_ms = 1000000000LL / freq_uhz;
+        if ((period_ms < 1) || (period_ms > UINT16_MAX)) {
+            return -EINVAL;
+        }
+        return lightranger9_set_period(dev, (uint16_t)period_ms);
+    } else {
+        return -ENOTSUP;
+    }
+}
+
+static int lightranger9_attr_get(const struct device *dev,
+                                 enum sensor_channel chan,
+                                 enum sensor_attribute attr,
+                                 struct sensor_value *val)
+{
+    lightranger9_data_t *data = dev->data;
+    uint32_t freq_uhz;
+
+    if ((int)attr == LIGHTRANGER9_SENSOR_ATTR_CONFIDENCE_THRESHOLD) {
+        val->val1 = data->confidence_threshold;
+        val->val2 = 0;
+#ifdef CONFIG_LIGHTRANGER9_HISTOGRAMS
+    } else if ((int)attr == LIGHTRANGER9_SENSOR_ATTR_HISTOGRAMS) {
+        val->val1 = data->hist_enabled;
+        val->val2 = 0;
+#endif
+    } else if ((int)attr == LIGHTRANGER9_SENSOR_ATTR_ZONE_MODE) {
+        val->val1 = data->zone_mode;
+        val->val2 = 0;
+    } else if ((int)attr == LIGHTRANGER9_SENSOR_ATTR_KILO_ITERATIONS) {
+        val->val1 = data->kilo_iterations;
+        val->val2 = 0;
+    } else if (attr == SENSOR_ATTR_SAMPLING_FREQUENCY) {
+        freq_uhz = 1000000000UL / data->period_ms;
+        val->val1 = freq_uhz / 1000000;
+        val->val2 = freq_uhz % 1000000;
+    } else {
+        return -ENOTSUP;
+    }
+
+    return 0;
+}
+
+static int lightranger9_decode_channel(const uint8_t *regs,
+                                      uint8_t zone_mode,
+                                      enum sensor_channel chan,
+                                      struct sensor_value *val)
+{
+    const lightranger9_zone_layout_t *layout = &lightranger9_zone_layouts[zone_mode];
+    uint32_t sys_tick;
+    uint8_t sc;
+    uint8_t rn;
+
+    val->val2 = 0;
+
+    switch ((int)chan) {
+    case LIGHTRANGER9_SENSOR_CHAN_SUB_CAPTURE:
+        sc = lightranger9_result_slot(layout, REGS_VAL(regs, LIGHTRANGER9_REG_RESULT_NUMBER), &rn);
+        val->val1 = sc;
+        break;
+    case LIGHTRANGER9_SENSOR_CHAN_RESULT_NUMBER:
+        lightranger9_result_slot(layout, REGS_VAL(regs, LIGHTRANGER9_REG_RESULT_NUMBER), &rn);
+        val->val1 = rn;
+        break;
+    case SENSOR_CHAN_DIE_TEMP:
+    case LIGHTRANGER9_SENSOR_CHAN_SENSOR_TEMPERATURE:
+        val->val1 = (int8_t)REGS_VAL(regs, LIGHTRANGER9_REG_TEMPERATURE);
+        break;
+    case LIGHTRANGER9_SENSOR_CHAN_VALID_RESULTS:
+        val->val1 = REGS_VAL(regs, LIGHTRANGER9_REG_NUMBER_VALID_RESULTS);
+        break;
+    case LIGHTRANGER9_SENSOR_CHAN_AMBIENT_LIGHT:
+        val->val1 = sys_get_le32(&regs[REGS_OFFSET(LIGHTRANGER9_REG_AMBIENT_LIGHT_0)]);
+        break;
+    case LIGHTRANGER9_SENSOR_CHAN_PHOTON_COUNT:
+        val->val1 = sys_get_le32(&regs[REGS_OFFSET(LIGHTRANGER9_REG_PHOTON_COUNT_0)]);
+        break;
+    case LIGHTRANGER9_SENSOR_CHAN_REFERENCE_COUNT:
+        val->val1 = sys_get_le32(&regs[REGS_OFFSET(LIGHTRANGER9_REG_REFERENCE_COUNT_0)]);
+        break;
+    case LIGHTRANGER9_SENSOR_CHAN_SYS_TICK_SEC:
+        // 0.2 us per tick, kept in integer math
+        sys_tick = sys_get_le32(&regs[REGS_OFFSET(LIGHTRANGER9_REG_SYS_TICK_0)]);
+        val->val1 = sys_tick / 5000000;
+        val->val2 = (sys_tick % 5000000) / 5;
+        break;
+    default:
+        return -ENOTSUP;
+    }
+
+    return 0;
+}
+
+static int lightranger9_channel_get(const struct device *dev,
+                                    enum sensor_channel chan,
+                                    struct sensor_value *val)
+{
+    lightranger9_data_t *data = dev->data;
+
+    /**
+     * Zone distances do not fit a sensor_value, use
+     * lightranger9_decode_frame() or lightranger9_decode_zone().
+     */
+    return lightranger9_decode_channel(&data->read_block[BLOCK_OFFSET(LIGHTRANGER9_REG_RESULT_NUMBER)],
+                                       data->zone_mode,
+                                       chan,
+                                       val);
+}
+
+#ifndef CONFIG_LIGHTRANGER9_REPLAY
+static int lightranger9_enable_device(const struct device *dev, bool power_cycle)
+{
+    const lightranger9_config_t *cfg = dev->config;
+    int ret;
     
+#ifdef CONFIG_SOC_NRF5340_CPUAPP
+    /**
+     * Claim pin from NETcore
+     */
+    nrf_gpio_pin_mcu_select(cfg->control_pin, NRF_GPIO_PIN_MCUSEL_APP);
+#endif
+
+    if (power_cycle) {
+        ret = gpio_pin_configure(cfg->control_ctrl, cfg->control_pin, GPIO_OUTPUT_LOW | cfg->control_flags);
+        ret = gpio_pin_configure(cfg->control_ctrl, cfg->gpio1_pin,   GPIO_OUTPUT_LOW | cfg->gpio1_flags);
+        ret = gpio_pin_configure(cfg->control_ctrl, cfg->int_pin,     GPIO_INPUT      | cfg->int_flags);
+        k_msleep(500);
+        ret = gpio_pin_set(cfg->control_ctrl, cfg->control_pin, 1);
+        ret = gpio_pin_set(cfg->control_ctrl, cfg->gpio1_pin, 0);
+    } else {
+        /**
+         * Drive the enable pin high straight away so a sensor which
+         * stayed powered across the MCU reset keeps running.
+         */
+        ret = gpio_pin_configure(cfg->control_ctrl, cfg->control_pin, GPIO_OUTPUT_HIGH | cfg->control_flags);
+        ret = gpio_pin_configure(cfg->control_ctrl, cfg->gpio1_pin,   GPIO_OUTPUT_LOW  | cfg->gpio1_flags);
+        ret = gpio_pin_configure(cfg->control_ctrl, cfg->int_pin,     GPIO_INPUT       | cfg->int_flags);
+    }
+
+    if (ret) {
+        LOG_ERR("Could not enable device!");
+    } else {
+        //do nothing
+    }
+    
+    return ret;
+}
+
+#ifdef CONFIG_LIGHTRANGER9_WARM_START
+static bool lightranger9_is_app_resident(const struct device *dev)
+{
+    uint8_t version[3] = {0};
+
+    if (!lightranger9_check_communication(dev)) {
+        return false;
+    }
+
+    // APPID, MINOR and PATCH are consecutive registers
+    if (lightranger9_read_register(dev, LIGHTRANGER9_REG_APPID, version, sizeof(version))) {
+        return false;
+    }
+
+    if (LIGHTRANGER9_APP_ID_MEASUREMENT != version[0]) {
+        return false;
+    }
+
+    if (((CONFIG_LIGHTRANGER9_WARM_START_APP_MINOR >= 0) &&
+         (CONFIG_LIGHTRANGER9_WARM_START_APP_MINOR != version[1])) ||
+        ((CONFIG_LIGHTRANGER9_WARM_START_APP_PATCH >= 0) &&
+         (CONFIG_LIGHTRANGER9_WARM_START_APP_PATCH != version[2]))) {
+        LOG_INF("Resident application %d.%d.%d is not the expected one",
+                version[0], version[1], version[2]);
+        return false;
+    }
+
+    LOG_INF("Measurement application %d.%d.%d already running",
+            version[0], version[1], version[2]);
+
+    return true;
+}
+
+static int lightranger9_warm_start(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    uint8_t timing[4] = {0};
+    uint8_t mode = 0;
+    uint8_t spad_map_id = 0;
+    uint8_t hist_dump = 0;
+    int error_flag;
+
+    /**
+     * Sensor configuration survived the MCU reset together with the
+     * application, the driver state is taken over from the common page
+     * so frames, iterations and the zone layout match what the sensor
+     * actually runs. Anything the driver cannot represent falls back to
+     * a cold start.
+     */
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+
+    error_flag  = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_STOP);
+    error_flag |= lightranger9_read_register(dev, LIGHTRANGER9_REG_MODE, &mode, 1);
+    error_flag |= lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_LOAD_CFG_PAGE_COMMON);
+    error_flag |= lightranger9_read_register(dev, LIGHTRANGER9_REG_PERIOD_MS_LSB, timing, sizeof(timing));
+    error_flag |= lightranger9_read_register(dev, LIGHTRANGER9_REG_SPAD_MAP_ID, &spad_map_id, 1);
+    error_flag |= lightranger9_read_register(dev, LIGHTRANGER9_REG_HIST_DUMP, &hist_dump, 1);
+
+    if (error_flag) {
+        // do nothing
+    } else if (mode == LIGHTRANGER9_MODE_TMF8828) {
+        data->zone_mode = LIGHTRANGER9_ZONE_MODE_8X8;
+    } else if (spad_map_id == LIGHTRANGER9_SPAD_MAP_4X4) {
+        data->zone_mode = LIGHTRANGER9_ZONE_MODE_4X4;
+    } else if (spad_map_id == LIGHTRANGER9_SPAD_MAP_3X3) {
+        data->zone_mode = LIGHTRANGER9_ZONE_MODE_3X3;
+    } else {
+        LOG_INF("Resident SPAD map %d is not a known zone mode", spad_map_id);
+        error_flag = -ENOTSUP;
+    }
+
+    if ((error_flag == 0) && (hist_dump != LIGHTRANGER9_HIST_DUMP_OFF)) {
+        // histograms are off until a consumer enables them
+        LOG_INF("Resident application dumps histograms");
+        error_flag = -ENOTSUP;
+    } else {
+        // do nothing
+    }
+
+    if (error_flag == 0) {
+        data->period_ms = sys_get_le16(&timing[0]);
+        data->kilo_iterations = sys_get_le16(&timing[2]);
+        data->read_kilo = data->kilo_iterations;
+        if ((data->period_ms == 0) || (data->kilo_iterations == 0)) {
+            error_flag = -ENOTSUP;
+        } else {
+            // do nothing
+        }
+    }
+
+#ifdef CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION
     /**
-     * Claim pin from NETcore
+     * Whether the resident application got the stored pages is unknown,
+     * they are loaded again the same way a cold start does.
      */
-    nrf_gpio_pin_mcu_select(cfg->control_pin, NRF_GPIO_PIN_MCUSEL_APP);
+    if ((error_flag == 0) && (data->zone_mode == LIGHTRANGER9_ZONE_MODE_8X8)) {
+        error_flag = lightranger9_load_calibration(dev);
+    }
+#endif
+
+    if (error_flag == 0) {
+        LOG_INF("Resumed zone mode %d, period %d ms, %d kilo iterations",
+                data->zone_mode, data->period_ms, data->kilo_iterations);
+        error_flag = lightranger9_start_measurement(dev);
+    } else {
+        // restore the defaults the cold start writes
+        data->zone_mode = LIGHTRANGER9_ZONE_MODE_8X8;
+        data->period_ms = LIGHTRANGER9_DEFAULT_MEASUREMENT_PERIOD_MS;
+        data->kilo_iterations = LIGHTRANGER9_DEFAULT_KILO_ITERATIONS;
+        data->read_kilo = data->kilo_iterations;
+    }
+
+    k_mutex_unlock(&data->cmd_lock);
+
+    return error_flag;
+}
+#endif /* CONFIG_LIGHTRANGER9_WARM_START */
+#endif /* CONFIG_LIGHTRANGER9_REPLAY */
+
+#ifdef CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION
+static int lightranger9_settings_set(const char *key, size_t len,
+                                     settings_read_cb read_cb, void *cb_arg,
+                                     void *param)
+{
+    lightranger9_data_t *data = param;
+    const char *next;
+    ssize_t rc;
+
+    if (!settings_name_steq(key, FC_SETTINGS_KEY, &next) || (next != NULL)) {
+        return 0;
+    }
 
-    ret = gpio_pin_configure(cfg->control_ctrl, cfg->control_pin, GPIO_OUTPUT_LOW | cfg->control_flags);
-    ret = gpio_pin_configure(cfg->control_ctrl, cfg->gpio1_pin,   GPIO_OUTPUT_LOW | cfg->gpio1_flags);
-    ret = gpio_pin_configure(cfg->control_ctrl, cfg->int_pin,     GPIO_INPUT      | cfg->int_flags);
-    k_msleep(500);
-    ret = gpio_pin_set(cfg->control_ctrl, cfg->control_pin, 1);
-    ret = gpio_pin_set(cfg->control_ctrl, cfg->gpio1_pin, 0);
+    if (len != sizeof(data->fc_pages)) {
+        LOG_WRN("Ignoring stored calibration of unexpected size %u", (uint32_t)len);
+        return 0;
+    }
+
+    rc = read_cb(cb_arg, data->fc_pages, sizeof(data->fc_pages));
+    data->fc_valid = (rc == sizeof(data->fc_pages));
+
+    return 0;
+}
+
+static void lightranger9_settings_load(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    char name[FC_SETTINGS_NAME_LEN];
+    int ret;
+
+    ret = settings_subsys_init();
+    if (ret == 0) {
+        snprintk(name, sizeof(name), FC_SETTINGS_ROOT "/%s", dev->name);
+        ret = settings_load_subtree_direct(name, lightranger9_settings_set, data);
+    }
 
     if (ret) {
-        LOG_ERR("Could not enable device!");
+        LOG_WRN("Could not load factory calibration (%d)", ret);
+    } else if (!data->fc_valid) {
+        LOG_INF("No factory calibration stored, running uncalibrated");
     } else {
-        //do nothing
+        // do nothing
     }
-    
+}
+
+static int lightranger9_write_fc_page(const struct device *dev, uint8_t *page)
+{
+    uint8_t chunk = LIGHTRANGER9_TX_BUF_SIZE - 1;
+    uint8_t offset;
+    int ret = 0;
+
+    // a page does not fit the transmit buffer at once
+    for (offset = 0; (ret == 0) && (offset < LIGHTRANGER9_FC_PAGE_SIZE); offset += chunk) {
+        ret = lightranger9_generic_write(dev,
+                                         LIGHTRANGER9_REG_FACTORY_CALIBRATION_FIRST + offset,
+                                         &page[offset],
+                                         MIN(chunk, LIGHTRANGER9_FC_PAGE_SIZE - offset));
+    }
+
     return ret;
 }
 
-static int lightranger9_init(const struct device *dev)
+static int lightranger9_load_calibration(const struct device *dev)
 {
-    int error_flag = 0;
+    lightranger9_data_t *data = dev->data;
+    uint8_t page;
+    int ret;
 
-    error_flag = lightranger9_enable_device(dev);
-    if (error_flag) {
-        LOG_ERR("Failed to setup pin!");
-        return -1;
+    if (!data->fc_valid) {
+        return 0;
+    }
+
+    /**
+     * Pages go back in the order they were captured,
+     * the sensor steps to the next SPAD configuration with each write.
+     */
+    ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_RESET_FACTORY_CAL);
+    for (page = 0; (ret == 0) && (page < LIGHTRANGER9_FC_PAGES); page++) {
+        ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_LOAD_CFG_PAGE_F_Y_CAL);
+        if (ret == 0) {
+            ret = lightranger9_write_fc_page(dev, data->fc_pages[page]);
+        }
+        if (ret == 0) {
+            ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_WRITE_CFG_PAGE);
+        }
+    }
+
+    if (ret) {
+        LOG_ERR("Failed to load factory calibration (%d)!", ret);
     } else {
-        // do nothing
+        LOG_DBG("Factory calibration loaded");
     }
 
+    return ret;
+}
+#endif /* CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION */
+
+#ifndef CONFIG_LIGHTRANGER9_REPLAY
+static int lightranger9_cold_start(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    int error_flag = 0;
+
     k_msleep(100);
     if (!lightranger9_check_communication(dev)) {
         LOG_ERR("No Communication with device!");
@@ -501,28 +2302,428 @@ static int lightranger9_init(const struct device *dev)
     
     error_flag |= lightranger9_write_register(dev,
                                               LIGHTRANGER9_REG_PERIOD_MS_LSB,
-                                              (uint8_t)((LIGHTRANGER9_DEFAULT_MEASUREMENT_PERIOD_MS)      & 0xFF));
+                                              (uint8_t)((data->period_ms)      & 0xFF));
     error_flag |= lightranger9_write_register(dev,
                                               LIGHTRANGER9_REG_PERIOD_MS_MSB,
-                                              (uint8_t)((LIGHTRANGER9_DEFAULT_MEASUREMENT_PERIOD_MS >> 8) & 0xFF));
+                                              (uint8_t)((data->period_ms >> 8) & 0xFF));
+    error_flag |= lightranger9_write_register(dev,
+                                              LIGHTRANGER9_REG_KILO_ITERATIONS_LSB,
+                                              (uint8_t)((data->kilo_iterations)      & 0xFF));
+    error_flag |= lightranger9_write_register(dev,
+                                              LIGHTRANGER9_REG_KILO_ITERATIONS_MSB,
+                                              (uint8_t)((data->kilo_iterations >> 8) & 0xFF));
     error_flag |= lightranger9_write_register(dev,
                                               LIGHTRANGER9_REG_CMD_STAT,
                                               LIGHTRANGER9_CMD_STAT_WRITE_CFG_PAGE);
     k_msleep(100);
 
-    //Enable measurement ready interrupt, start measurement and clear interrupts
-    error_flag |= lightranger9_write_register(dev,
-                                              LIGHTRANGER9_REG_INT_ENAB,
-                                              LIGHTRANGER9_INT_ENAB_MEAS_READY);
-    error_flag |= lightranger9_write_register(dev,
-                                              LIGHTRANGER9_REG_CONFIG_RESULT,
-                                              LIGHTRANGER9_CONFIG_RESULT_MEAS);
-    error_flag |= lightranger9_write_register(dev,
-                                              LIGHTRANGER9_REG_CMD_STAT,
-                                              LIGHTRANGER9_CMD_STAT_MEASURE);
-    error_flag |= lightranger9_clear_interrupts(dev);
+    if (data->zone_mode == LIGHTRANGER9_ZONE_MODE_8X8) {
+#ifdef CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION
+        error_flag |= lightranger9_load_calibration(dev);
+#endif
+    } else {
+        // the application always boots in 8x8, e.g. after a failed wake up
+        error_flag |= lightranger9_apply_zone_mode(dev, data->zone_mode);
+    }
+
+    error_flag |= lightranger9_start_measurement(dev);
     k_msleep(100);
 
+    return error_flag;
+}
+#endif /* CONFIG_LIGHTRANGER9_REPLAY */
+
+#ifdef CONFIG_LIGHTRANGER9_REPLAY
+static int lightranger9_recover(const struct device *dev, int fault)
+{
+    // nothing on the bus to recover
+    ARG_UNUSED(dev);
+
+    return fault;
+}
+#else
+static int lightranger9_recover(const struct device *dev, int fault)
+{
+    const lightranger9_config_t *cfg = dev->config;
+    lightranger9_data_t *data = dev->data;
+    k_spinlock_key_t key;
+    bool bus_recovered = false;
+    bool reinit;
+    uint8_t claimed;
+    uint8_t app_id = 0;
+    int ret;
+
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+
+    /**
+     * Captures queued before the fault are dropped, so the first one
+     * fetched afterwards really was taken after the recovery. The slot
+     * the application has claimed stays with it.
+     */
+    key = k_spin_lock(&data->lock);
+    if (fault != 0) {
+        data->fault_stats.faults++;
+    } else {
+        // retry of a failed recovery, not a new fault
+    }
+    if (data->fault_ms == 0) {
+        data->fault_ms = MAX(k_uptime_get_32(), 1);
+    } else {
+        // still recovering from an earlier fault
+    }
+    claimed = data->fifo_claimed ? 1 : 0;
+    data->fifo_head = (data->fifo_tail + claimed) % LIGHTRANGER9_FIFO_DEPTH;
+    data->fifo_count = claimed;
+    k_spin_unlock(&data->lock, key);
+
+    /**
+     * A slave holding SDA low after an aborted transfer blocks every
+     * further transfer, clock it free first. Not all controllers can.
+     */
+    ret = i2c_recover_bus(cfg->bus.bus);
+    if (ret == 0) {
+        bus_recovered = true;
+    } else if (ret != -ENOSYS) {
+        LOG_WRN("I2C bus recovery failed (%d)", ret);
+    } else {
+        // do nothing
+    }
+
+    /**
+     * If the measurement application is still loaded and answers
+     * commands only the measurement needs restarting, the firmware
+     * download and configuration of a full init are skipped.
+     */
+    ret = lightranger9_read_register(dev, LIGHTRANGER9_REG_APPID, &app_id, 1);
+    if ((ret == 0) && (app_id == LIGHTRANGER9_APP_ID_MEASUREMENT)) {
+        ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_STOP);
+    } else {
+        ret = -ENODEV;
+    }
+
+    if (ret == 0) {
+        ret = lightranger9_start_measurement(dev);
+        reinit = false;
+    } else {
+        LOG_WRN("Sensor lost its application (%d), reinitializing", ret);
+        ret = lightranger9_enable_device(dev, true);
+        if (ret == 0) {
+            ret = lightranger9_cold_start(dev);
+        } else {
+            // do nothing
+        }
+        reinit = true;
+    }
+
+    key = k_spin_lock(&data->lock);
+    data->fault_stats.bus_recoveries += bus_recovered ? 1 : 0;
+    if (reinit) {
+        data->fault_stats.reinits++;
+    } else {
+        data->fault_stats.resyncs++;
+    }
+    if (ret) {
+        data->fault_stats.failures++;
+    } else {
+        // do nothing
+    }
+    k_spin_unlock(&data->lock, key);
+
+    if (ret == 0) {
+        LOG_INF("Recovered from fault %d", fault);
+        ret = -EAGAIN;
+    } else {
+        LOG_ERR("Fault recovery failed (%d)!", ret);
+    }
+
+    k_mutex_unlock(&data->cmd_lock);
+
+    return ret;
+}
+#endif /* CONFIG_LIGHTRANGER9_REPLAY */
+
+#ifdef CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION
+int lightranger9_factory_calibrate(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    char name[FC_SETTINGS_NAME_LEN];
+    uint8_t page;
+    int ret;
+
+    if (data->zone_mode != LIGHTRANGER9_ZONE_MODE_8X8) {
+        return -ENOTSUP;
+    }
+
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+
+    /**
+     * Calibrate each of the 8x8 SPAD configurations in turn,
+     * reading its calibration page back after every run.
+     */
+    ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_STOP);
+    if (ret == 0) {
+        ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_RESET_FACTORY_CAL);
+    }
+    for (page = 0; (ret == 0) && (page < LIGHTRANGER9_FC_PAGES); page++) {
+        ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_FACTORY_CALIBRATION);
+        if (ret == 0) {
+            ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_LOAD_CFG_PAGE_F_Y_CAL);
+        }
+        if (ret == 0) {
+            ret = lightranger9_read_register(dev,
+                                             LIGHTRANGER9_REG_FACTORY_CALIBRATION_FIRST,
+                                             data->fc_pages[page],
+                                             LIGHTRANGER9_FC_PAGE_SIZE);
+        }
+    }
+
+    if (ret == 0) {
+        data->fc_valid = true;
+        snprintk(name, sizeof(name), FC_SETTINGS_ROOT "/%s/" FC_SETTINGS_KEY, dev->name);
+        ret = settings_save_one(name, data->fc_pages, sizeof(data->fc_pages));
+        if (ret) {
+            LOG_ERR("Failed to store factory calibration (%d)!", ret);
+        } else {
+            LOG_INF("Factory calibration stored");
+        }
+    } else {
+        data->fc_valid = false;
+        LOG_ERR("Factory calibration failed (%d)!", ret);
+    }
+
+    // the calibration just captured is active, carry on measuring
+    ret |= lightranger9_start_measurement(dev);
+
+    k_mutex_unlock(&data->cmd_lock);
+
+    return ret;
+}
+
+bool lightranger9_is_calibrated(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    return data->fc_valid;
+}
+#endif /* CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION */
+
+#ifdef CONFIG_PM_DEVICE
+static void lightranger9_pm_account(lightranger9_data_t *data, bool standby)
+{
+    uint32_t now_ms = k_uptime_get_32();
+
+    if (data->standby) {
+        data->pm_stats.standby_ms += now_ms - data->pm_since_ms;
+    } else {
+        data->pm_stats.active_ms += now_ms - data->pm_since_ms;
+    }
+    data->pm_since_ms = now_ms;
+    data->standby = standby;
+}
+
+static int lightranger9_wait_cpu_ready(const struct device *dev)
+{
+    uint32_t start = k_uptime_get_32();
+    uint32_t delay_us = BL_POLL_MIN_US;
+    uint8_t enable = 0;
+    int ret;
+
+    while (true) {
+        ret = lightranger9_read_register(dev, LIGHTRANGER9_REG_ENABLE, &enable, 1);
+        if ((ret == 0) && (enable & LIGHTRANGER9_ENABLE_CPU_READY)) {
+            return 0;
+        } else if ((k_uptime_get_32() - start) > LIGHTRANGER9_TIMEOUT) {
+            return -ETIMEDOUT;
+        } else {
+            lightranger9_poll_wait(&delay_us);
+        }
+    }
+}
+
+static int lightranger9_standby(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    int ret;
+
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+
+    /**
+     * Stop measuring and release the INT line first, the measurement
+     * application and its configuration stay in RAM during standby.
+     */
+    ret = lightranger9_send_cmd(dev, LIGHTRANGER9_CMD_STAT_STOP);
+    if (ret == 0) {
+        ret = lightranger9_clear_interrupts(dev);
+    }
+    if (ret == 0) {
+        ret = lightranger9_write_register(dev, LIGHTRANGER9_REG_ENABLE, LIGHTRANGER9_ENABLE_STANDBY);
+    }
+    if (ret == 0) {
+        data->pm_stats.suspends++;
+        lightranger9_pm_account(data, true);
+    } else {
+        LOG_ERR("Failed to enter standby (%d)!", ret);
+    }
+
+    k_mutex_unlock(&data->cmd_lock);
+
+    return ret;
+}
+
+static int lightranger9_wake(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    uint32_t start = k_cycle_get_32();
+    uint8_t app_id = 0;
+    int ret;
+
+    k_mutex_lock(&data->cmd_lock, K_FOREVER);
+
+    ret = lightranger9_write_register(dev, LIGHTRANGER9_REG_ENABLE, LIGHTRANGER9_ENABLE_PON);
+    if (ret == 0) {
+        ret = lightranger9_wait_cpu_ready(dev);
+    }
+    if (ret == 0) {
+        ret = lightranger9_read_register(dev, LIGHTRANGER9_REG_APPID, &app_id, 1);
+    }
+
+    if ((ret == 0) && (app_id == LIGHTRANGER9_APP_ID_MEASUREMENT)) {
+        ret = lightranger9_start_measurement(dev);
+    } else {
+        // the application was lost, e.g. the sensor lost power meanwhile
+        LOG_WRN("Measurement application lost in standby, reloading");
+        ret = lightranger9_enable_device(dev, true);
+        if (ret == 0) {
+            ret = lightranger9_cold_start(dev);
+        } else {
+            // do nothing
+        }
+    }
+
+    if (ret == 0) {
+        data->pm_stats.resumes++;
+        data->pm_stats.last_wake_us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+        data->pm_stats.max_wake_us = MAX(data->pm_stats.max_wake_us, data->pm_stats.last_wake_us);
+        lightranger9_pm_account(data, false);
+    } else {
+        LOG_ERR("Failed to wake up (%d)!", ret);
+    }
+
+    k_mutex_unlock(&data->cmd_lock);
+
+    return ret;
+}
+
+static int lightranger9_pm_action(const struct device *dev,
+                                  enum pm_device_action action)
+{
+    int ret;
+
+    switch (action) {
+    case PM_DEVICE_ACTION_SUSPEND:
+        ret = lightranger9_standby(dev);
+        break;
+    case PM_DEVICE_ACTION_RESUME:
+        ret = lightranger9_wake(dev);
+        break;
+    default:
+        ret = -ENOTSUP;
+        break;
+    }
+
+    return ret;
+}
+#endif /* CONFIG_PM_DEVICE */
+
+static int lightranger9_init(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    bool power_cycle = !IS_ENABLED(CONFIG_LIGHTRANGER9_WARM_START);
+    int error_flag = 0;
+
+    data->dev = dev;
+    data->init_start_ms = k_uptime_get_32();
+    data->read_block = data->fifo_block[0];
+    data->period_ms = LIGHTRANGER9_DEFAULT_MEASUREMENT_PERIOD_MS;
+    data->kilo_iterations = LIGHTRANGER9_DEFAULT_KILO_ITERATIONS;
+    data->read_kilo = data->kilo_iterations;
+    data->confidence_threshold = LIGHTRANGER9_CONFIDENCE_THRESHOLD;
+    k_mutex_init(&data->cmd_lock);
+#ifdef CONFIG_LIGHTRANGER9_HISTOGRAMS
+    k_sem_init(&data->hist_sem, 0, CONFIG_LIGHTRANGER9_HIST_RING_SIZE);
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION
+    lightranger9_settings_load(dev);
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_REPLAY
+    // captures come from the recording, the sensor is not touched
+    ARG_UNUSED(power_cycle);
+    error_flag = lightranger9_store_init(dev);
+#else
+    error_flag = lightranger9_enable_device(dev, power_cycle);
+    if (error_flag) {
+        LOG_ERR("Failed to setup pin!");
+        return -1;
+    } else {
+        // do nothing
+    }
+
+#ifdef CONFIG_LIGHTRANGER9_TRIGGER
+    if (lightranger9_init_interrupt(dev)) {
+        return -1;
+    } else {
+        // do nothing
+    }
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_WARM_START
+    if (lightranger9_is_app_resident(dev)) {
+        error_flag = lightranger9_warm_start(dev);
+    } else {
+        error_flag = -ENODEV;
+    }
+
+    if (error_flag) {
+        // Unknown sensor state, reset it to the bootloader
+        error_flag = lightranger9_enable_device(dev, true);
+        if (error_flag == 0) {
+            error_flag = lightranger9_cold_start(dev);
+        } else {
+            // do nothing
+        }
+    } else {
+        // do nothing
+    }
+#else
+    error_flag = lightranger9_cold_start(dev);
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_RECORD
+    if (error_flag == 0) {
+        // a missing partition only leaves the capture unrecorded
+        lightranger9_store_init(dev);
+    } else {
+        // do nothing
+    }
+#endif
+
+#ifdef CONFIG_PM_DEVICE
+    data->pm_since_ms = k_uptime_get_32();
+#endif
+#ifdef CONFIG_PM_DEVICE_RUNTIME
+    /**
+     * The sensor goes to standby until a consumer needs frames
+     * and calls pm_device_runtime_get().
+     */
+    if (error_flag == 0) {
+        pm_device_runtime_enable(dev);
+    } else {
+        // do nothing
+    }
+#endif
+#endif /* CONFIG_LIGHTRANGER9_REPLAY */
+
     if (error_flag == 0) {
         LOG_DBG("Sensor initialized successfully!");
     } else {
@@ -533,15 +2734,38 @@ static int lightranger9_init(const struct device *dev)
 }
 
 static const struct sensor_driver_api lightranger9_api = {
+    .attr_set     = lightranger9_attr_set,
+    .attr_get     = lightranger9_attr_get,
+#ifdef CONFIG_LIGHTRANGER9_TRIGGER
+    .trigger_set  = lightranger9_trigger_set,
+#endif
     .sample_fetch = lightranger9_sample_fetch,
     .channel_get  = lightranger9_channel_get
 };
 
-DEVICE_DT_INST_DEFINE(0,
-                      lightranger9_init,
-                      NULL,
-                      &lightranger9_meas_cpt,
-                      &lightranger9_config,
-                      POST_KERNEL,
-                      CONFIG_SENSOR_INIT_PRIORITY,
-                      &lightranger9_api);
\ No newline at end of file
+#define LIGHTRANGER9_DEFINE(inst)                                                           \
+    static lightranger9_data_t lightranger9_data_##inst;                                    \
+                                                                                            \
+    static const lightranger9_config_t lightranger9_config_##inst = {                       \
+        .bus = I2C_DT_SPEC_INST_GET(inst),                                                  \
+        .control_ctrl = DEVICE_DT_GET(DT_GPIO_CTLR(DT_DRV_INST(inst), control_gpios)),      \
+        .control_pin = DT_INST_GPIO_PIN_BY_IDX(inst, control_gpios, 0),                     \
+        .control_flags = DT_INST_GPIO_FLAGS_BY_IDX(inst, control_gpios, 0),                 \
+        .int_pin = DT_INST_GPIO_PIN_BY_IDX(inst, control_gpios, 1),                         \
+        .int_flags = DT_INST_GPIO_FLAGS_BY_IDX(inst, control_gpios, 1),                     \
+        .gpio1_pin = DT_INST_GPIO_PIN_BY_IDX(inst, control_gpios, 2),                       \
+        .gpio1_flags = DT_INST_GPIO_FLAGS_BY_IDX(inst, control_gpios, 2)                    \
+    };                                                                                      \
+                                                                                            \
+    PM_DEVICE_DT_INST_DEFINE(inst, lightranger9_pm_action);                                 \
+                                                                                            \
+    DEVICE_DT_INST_DEFINE(inst,                                                             \
+                          lightranger9_init,                                                \
+                          PM_DEVICE_DT_INST_REF(inst),                                      \
+                          &lightranger9_data_##inst,                                        \
+                          &lightranger9_config_##inst,                                      \
+                          POST_KERNEL,                                                      \
+                          CONFIG_SENSOR_INIT_PRIORITY,                                      \
+                          &lightranger9_api);
+
+DT_INST_FOREACH_STATUS_OKAY(LIGHTRANGER9_DEFINE)
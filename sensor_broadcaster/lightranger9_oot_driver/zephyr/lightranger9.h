@@ -51,6 +51,9 @@ extern "C" {
 #include <drivers/i2c.h>
 #include <drivers/sensor.h>
 #include <drivers/gpio.h>
+#ifdef CONFIG_LIGHTRANGER9_CAPTURE_STORE
+#include <storage/flash_map.h>
+#endif
 
 #define LIGHTRANGER9_REG_APPID                      0x00
 #define LIGHTRANGER9_REG_MINOR                      0x01
@@ -310,6 +313,21 @@ extern "C" {
 #define LIGHTRANGER9_REG_BL_SIZE                    0x09
 #define LIGHTRANGER9_REG_BL_DATA                    0x0A
 
+/**
+ * @brief LightRanger 9 bootloader command frame size.
+ * @details The bootloader accepts at most 128 data bytes per command, a frame on
+ * the bus is register address, command, size, data and checksum.
+ */
+#define LIGHTRANGER9_BL_MAX_CHUNK_BYTES             128
+#define LIGHTRANGER9_BL_FRAME_SIZE                  (LIGHTRANGER9_BL_MAX_CHUNK_BYTES + 4)
+
+/**
+ * @brief LightRanger 9 transmit buffer size.
+ * @details Largest write on the bus, a bootloader command frame. Register
+ * writes are limited to the register address and 131 data bytes.
+ */
+#define LIGHTRANGER9_TX_BUF_SIZE                    LIGHTRANGER9_BL_FRAME_SIZE
+
 /*! @} */ // lightranger9_reg
 
 /**
@@ -337,6 +355,7 @@ extern "C" {
 #define LIGHTRANGER9_ENABLE_POWERUP_BL_NO_SLP       0x10
 #define LIGHTRANGER9_ENABLE_POWERUP_RAM             0x20
 #define LIGHTRANGER9_ENABLE_PON                     0x01
+#define LIGHTRANGER9_ENABLE_STANDBY                 0x00
 
 /**
  * @brief LightRanger 9 int enable register settings.
@@ -368,6 +387,7 @@ extern "C" {
 #define LIGHTRANGER9_CMD_STAT_LOAD_CFG_PAGE_SPAD_1  0x17
 #define LIGHTRANGER9_CMD_STAT_LOAD_CFG_PAGE_SPAD_2  0x18
 #define LIGHTRANGER9_CMD_STAT_LOAD_CFG_PAGE_F_Y_CAL 0x19
+#define LIGHTRANGER9_CMD_STAT_RESET_FACTORY_CAL     0x1F
 #define LIGHTRANGER9_CMD_STAT_FACTORY_CALIBRATION   0x20
 #define LIGHTRANGER9_CMD_STAT_I2C_SLAVE_ADDRESS     0x21
 #define LIGHTRANGER9_CMD_STAT_FORCE_TMF8820         0x65
@@ -447,6 +467,55 @@ extern "C" {
 #define LIGHTRANGER9_RESULT_NUMBER_MASK             0x3F
 #define LIGHTRANGER9_SYS_TICK_TO_SEC                0.0000002
 #define LIGHTRANGER9_OBJECT_MAP_SIZE                64
+#define LIGHTRANGER9_PARTIAL_MAX_ZONES              16
+
+/**
+ * @brief LightRanger 9 legacy SPAD maps.
+ * @details SPAD_MAP_ID values of the TMF8820 compatible zone modes.
+ */
+#define LIGHTRANGER9_SPAD_MAP_3X3                   1
+#define LIGHTRANGER9_SPAD_MAP_4X4                   7
+
+/**
+ * @brief LightRanger 9 MODE register values.
+ */
+#define LIGHTRANGER9_MODE_TMF8820                   0x00
+#define LIGHTRANGER9_MODE_TMF8828                   0x08
+
+/**
+ * @brief LightRanger 9 encoded capture size.
+ * @details Registers from RESULT_NUMBER up to the last result kept by lightranger9_encode().
+ */
+#define LIGHTRANGER9_ENCODED_REGS_SIZE              (LIGHTRANGER9_REG_RES_DISTANCE_35_MSB - LIGHTRANGER9_REG_RESULT_NUMBER + 1)
+
+/**
+ * @brief LightRanger 9 factory calibration size.
+ * @details In 8x8 mode the sensor is calibrated once per SPAD configuration,
+ * each calibration page holds the registers from the first factory calibration
+ * register up to the last one.
+ */
+#define LIGHTRANGER9_FC_PAGES                       4
+#define LIGHTRANGER9_FC_PAGE_SIZE                   (LIGHTRANGER9_REG_FACTORY_CALIBRATION_LAST - LIGHTRANGER9_REG_FACTORY_CALIBRATION_FIRST + 1)
+
+/**
+ * @brief LightRanger 9 capture FIFO depth.
+ * @details Without a trigger thread captures are read on demand into a single slot.
+ */
+#ifdef CONFIG_LIGHTRANGER9_TRIGGER
+#define LIGHTRANGER9_FIFO_DEPTH                     CONFIG_LIGHTRANGER9_FIFO_DEPTH
+#else
+#define LIGHTRANGER9_FIFO_DEPTH                     1
+#endif
+
+/**
+ * @brief LightRanger 9 histogram settings.
+ * @details Specified histogram dump settings and packet size of LightRanger 9 Click driver,
+ * a packet is read from CONFIG_RESULT up to the last subpacket data byte.
+ */
+#define LIGHTRANGER9_HIST_DUMP_OFF                  0x00
+#define LIGHTRANGER9_HIST_DUMP_RAW                  0x01
+#define LIGHTRANGER9_HIST_DATA_SIZE                 128
+#define LIGHTRANGER9_HIST_PACKET_SIZE               (LIGHTRANGER9_REG_SUBPACKET_DATA127 - LIGHTRANGER9_REG_CONFIG_RESULT + 1)
 
 /**
  * @brief LightRanger 9 default measurement period and confidence threshold.
@@ -455,6 +524,12 @@ extern "C" {
 #define LIGHTRANGER9_DEFAULT_MEASUREMENT_PERIOD_MS  1000
 #define LIGHTRANGER9_CONFIDENCE_THRESHOLD           100
 
+/**
+ * @brief LightRanger 9 default integration.
+ * @details Kilo iterations the measurement application uses after boot.
+ */
+#define LIGHTRANGER9_DEFAULT_KILO_ITERATIONS        537
+
 /**
  * @brief LightRanger 9 device ID value.
  * @details Specified device ID value of LightRanger 9 Click driver.
@@ -472,6 +547,45 @@ enum lightranger9_channel {
     LIGHTRANGER9_SENSOR_CHAN_SYS_TICK_SEC
 };
 
+enum lightranger9_attribute {
+    /**
+     * Minimum confidence (0-255) a result needs for its distance to be
+     * reported, lower confidence results read as 0 mm.
+     */
+    LIGHTRANGER9_SENSOR_ATTR_CONFIDENCE_THRESHOLD = SENSOR_ATTR_PRIV_START,
+
+    /**
+     * Raw histogram streaming on (1) or off (0),
+     * requires CONFIG_LIGHTRANGER9_HISTOGRAMS.
+     */
+    LIGHTRANGER9_SENSOR_ATTR_HISTOGRAMS,
+
+    /**
+     * Zone layout, one of enum lightranger9_zone_mode.
+     */
+    LIGHTRANGER9_SENSOR_ATTR_ZONE_MODE,
+
+    /**
+     * Integration time in kilo iterations. With
+     * CONFIG_LIGHTRANGER9_ADAPTIVE_ITERATIONS the value set is where
+     * the controller continues from.
+     */
+    LIGHTRANGER9_SENSOR_ATTR_KILO_ITERATIONS,
+};
+
+/**
+ * @brief LightRanger 9 zone modes.
+ * @details 8x8 is assembled from four sub-captures. 4x4 and 3x3 run the
+ * sensor as a TMF8820, they need two and one capture per frame and only
+ * fill the first 16 and 9 zones of the object maps. The sub-capture and
+ * frame number are taken from RESULT_NUMBER as the zone mode encodes them.
+ */
+enum lightranger9_zone_mode {
+    LIGHTRANGER9_ZONE_MODE_8X8 = 0,
+    LIGHTRANGER9_ZONE_MODE_4X4,
+    LIGHTRANGER9_ZONE_MODE_3X3,
+};
+
 /**
  * @brief LightRanger 9 Click return value data.
  * @details Predefined enum values for driver return values.
@@ -519,6 +633,266 @@ typedef struct __attribute__((__packed__)) lightranger9_meas_cpt_type {
     lightranger9_meas_result_t result[LIGHTRANGER9_MAX_MEAS_RESULTS];
 } lightranger9_meas_cpt_t;
 
+/**
+ * @brief A raw histogram packet as read from the sensor
+ */
+typedef struct __attribute__((__packed__)) lightranger9_hist_packet_type {
+    uint8_t cid;
+    uint8_t tid;
+    uint16_t size;
+    uint8_t number;
+    uint8_t payload;
+    uint8_t config;
+    uint8_t data[LIGHTRANGER9_HIST_DATA_SIZE];
+} lightranger9_hist_packet_t;
+
+/**
+ * @brief A capture in compact raw form, decoded on demand
+ * by lightranger9_decode() and lightranger9_decode_zone()
+ */
+typedef struct __attribute__((__packed__)) lightranger9_encoded_capture_type {
+    uint32_t timestamp;
+    uint8_t confidence_threshold;
+    uint8_t zone_mode;
+    uint8_t regs[LIGHTRANGER9_ENCODED_REGS_SIZE];
+} lightranger9_encoded_capture_t;
+
+/**
+ * @brief Frame assembly statistics
+ */
+typedef struct lightranger9_frame_stats_type {
+    uint32_t frames;
+    uint32_t partial;
+    uint32_t dropped;
+} lightranger9_frame_stats_t;
+
+/**
+ * @brief Fault recovery statistics, see lightranger9_get_fault_stats()
+ */
+typedef struct lightranger9_fault_stats_type {
+    uint32_t faults;
+    uint32_t bus_recoveries;
+    uint32_t resyncs;
+    uint32_t reinits;
+    uint32_t failures;
+    uint32_t last_recovery_ms;
+    uint32_t max_recovery_ms;
+} lightranger9_fault_stats_t;
+
+/**
+ * @brief Capture FIFO statistics
+ */
+typedef struct lightranger9_fifo_stats_type {
+    uint32_t overflows;
+    uint8_t pending;
+    uint8_t high_water;
+} lightranger9_fifo_stats_t;
+
+/**
+ * @brief Power management statistics, see lightranger9_get_pm_stats()
+ */
+typedef struct lightranger9_pm_stats_type {
+    uint32_t suspends;
+    uint32_t resumes;
+    uint32_t last_wake_us;
+    uint32_t max_wake_us;
+    uint32_t active_ms;
+    uint32_t standby_ms;
+    uint32_t frames;
+    uint32_t charge_per_frame_uc;
+} lightranger9_pm_stats_t;
+
+/**
+ * @brief Bus transaction types, see lightranger9_get_bus_stats()
+ */
+enum lightranger9_bus_op {
+    LIGHTRANGER9_BUS_OP_BLOCK_READ = 0,
+    LIGHTRANGER9_BUS_OP_REG_READ,
+    LIGHTRANGER9_BUS_OP_REG_WRITE,
+    LIGHTRANGER9_BUS_OP_BL_CMD,
+    LIGHTRANGER9_BUS_OP_COUNT
+};
+
+/**
+ * @brief Latency histogram buckets, bucket b counts transactions of
+ * 2^(b-1) up to 2^b - 1 us, the last one everything slower.
+ */
+#define LIGHTRANGER9_BUS_HIST_BUCKETS               16
+
+/**
+ * @brief Statistics of one bus transaction type
+ */
+typedef struct lightranger9_bus_op_stats_type {
+    uint32_t count;
+    uint32_t errors;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t hist[LIGHTRANGER9_BUS_HIST_BUCKETS];
+} lightranger9_bus_op_stats_t;
+
+/**
+ * @brief Bus transaction statistics, indexed by enum lightranger9_bus_op
+ */
+typedef struct lightranger9_bus_stats_type {
+    lightranger9_bus_op_stats_t op[LIGHTRANGER9_BUS_OP_COUNT];
+} lightranger9_bus_stats_t;
+
+/**
+ * @brief Runtime data of LIGHTRANGER9 module
+ */
+typedef struct lightranger9_data_type {
+    const struct device *dev;
+
+    /**
+     * FIFO of raw block reads stamped with k_cycle_get_32() and the kilo
+     * iterations in effect when they were read. The trigger thread fills
+     * the slot at fifo_head while sample_fetch() claims the oldest one at
+     * fifo_tail as read_block, fifo_count includes it.
+     */
+    uint8_t fifo_block[LIGHTRANGER9_FIFO_DEPTH][LIGHTRANGER9_BLOCKREAD_SIZE];
+    uint32_t fifo_stamp[LIGHTRANGER9_FIFO_DEPTH];
+    uint16_t fifo_kilo[LIGHTRANGER9_FIFO_DEPTH];
+    uint8_t fifo_head;
+    uint8_t fifo_tail;
+    uint8_t fifo_count;
+    bool fifo_claimed;
+    lightranger9_fifo_stats_t fifo_stats;
+    uint8_t *read_block;
+    uint32_t read_stamp;
+    uint16_t read_kilo;
+    uint32_t int_stamp;
+    struct k_spinlock lock;
+
+    /**
+     * Serializes multi transaction sequences on the sensor, e.g. a
+     * config page update against a capture read.
+     */
+    struct k_mutex cmd_lock;
+
+    /**
+     * Runtime configuration, see sensor_attr_set()
+     */
+    uint16_t period_ms;
+    uint16_t kilo_iterations;
+    uint8_t confidence_threshold;
+    uint8_t zone_mode;
+
+#ifdef CONFIG_LIGHTRANGER9_ADAPTIVE_ITERATIONS
+    /**
+     * Integration controller state, see lightranger9_adapt_iterations().
+     * iter_target is the setting to apply between frames, 0 when none.
+     */
+    uint8_t iter_valid_ref;
+    uint8_t iter_strong_frames;
+    uint16_t iter_target;
+#endif
+
+    /**
+     * Frame assembly state of lightranger9_parse_measurement() and
+     * lightranger9_decode_frame(): result number and kilo iterations of
+     * the frame being assembled and a bit per sub-capture already in it.
+     */
+    uint8_t frame_result_number;
+    uint16_t frame_kilo;
+    uint8_t frame_slots;
+    lightranger9_frame_stats_t frame_stats;
+
+    /**
+     * Transmit buffer for register writes and bootloader command frames,
+     * owned by whoever holds cmd_lock. Firmware chunks are copied from
+     * flash straight into it since EasyDMA can only read RAM.
+     */
+    uint8_t tx_buf[LIGHTRANGER9_TX_BUF_SIZE] __aligned(4);
+
+    /**
+     * Cold start timing in milliseconds.
+     */
+    uint32_t init_start_ms;
+    uint32_t fw_download_ms;
+    uint32_t boot_to_first_frame_ms;
+
+    /**
+     * Fault recovery, fault_ms is the uptime of the oldest fault not
+     * yet followed by a capture, 0 if there is none.
+     */
+    lightranger9_fault_stats_t fault_stats;
+    uint32_t fault_ms;
+
+#ifdef CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION
+    /**
+     * Factory calibration pages as stored in settings, written to the
+     * sensor on every cold start once fc_valid.
+     */
+    uint8_t fc_pages[LIGHTRANGER9_FC_PAGES][LIGHTRANGER9_FC_PAGE_SIZE];
+    bool fc_valid;
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_BUS_STATS
+    /**
+     * Counters and latencies of every I2C transaction, under lock
+     */
+    lightranger9_bus_stats_t bus_stats;
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_CAPTURE_STORE
+    /**
+     * Capture recording in the lightranger9_captures partition and the
+     * offset of the next record to write or replay. Replay releases a
+     * capture at store_due_ms, recorded store_stamp_ms after the previous.
+     */
+    const struct flash_area *store;
+    uint32_t store_offset;
+    uint32_t store_stamp_ms;
+    uint32_t store_due_ms;
+#endif
+
+#ifdef CONFIG_PM_DEVICE
+    /**
+     * Time and frame accounting for the energy estimate,
+     * pm_since_ms is the uptime of the last standby or wake.
+     */
+    lightranger9_pm_stats_t pm_stats;
+    uint32_t pm_since_ms;
+    bool standby;
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_TRIGGER
+    struct gpio_callback gpio_cb;
+    sensor_trigger_handler_t drdy_handler;
+    struct sensor_trigger drdy_trigger;
+
+    /**
+     * Retries a failed fault recovery from the trigger thread,
+     * recover_pending tells it to recover instead of reading a capture.
+     */
+    struct k_timer retry_timer;
+    bool recover_pending;
+
+#ifdef CONFIG_LIGHTRANGER9_HISTOGRAMS
+    /**
+     * Histogram packets, written by the trigger thread at hist_head and
+     * drained by lightranger9_hist_get() at hist_tail. hist_stalled is
+     * set when a packet was left on the sensor because the ring was full.
+     */
+    lightranger9_hist_packet_t hist_ring[CONFIG_LIGHTRANGER9_HIST_RING_SIZE];
+    uint32_t hist_head;
+    uint32_t hist_tail;
+    struct k_sem hist_sem;
+    bool hist_enabled;
+    bool hist_stalled;
+    uint32_t hist_stalls;
+#endif
+
+#if defined(CONFIG_LIGHTRANGER9_TRIGGER_OWN_THREAD)
+    K_KERNEL_STACK_MEMBER(thread_stack, CONFIG_LIGHTRANGER9_THREAD_STACK_SIZE);
+    struct k_thread thread;
+    struct k_sem gpio_sem;
+#elif defined(CONFIG_LIGHTRANGER9_TRIGGER_GLOBAL_THREAD)
+    struct k_work work;
+#endif
+#endif /* CONFIG_LIGHTRANGER9_TRIGGER */
+} lightranger9_data_t;
+
 /**
  * @brief Contains measurements
  */
@@ -530,10 +904,26 @@ typedef struct __attribute__((__packed__)) lightranger9_measurement_type {
     uint32_t photon_count;
     uint32_t reference_count;
     float sys_tick_sec;
+    uint8_t zones;
+    uint16_t kilo_iterations;
     lightranger9_meas_result_t obj1[LIGHTRANGER9_OBJECT_MAP_SIZE];
     lightranger9_meas_result_t obj2[LIGHTRANGER9_OBJECT_MAP_SIZE];
 } lightranger9_measurement_t;
 
+/**
+ * @brief The zones of a single sub-capture, see lightranger9_decode_partial().
+ * obj1[i] and obj2[i] both belong to zone zone[i] of the frame.
+ */
+typedef struct __attribute__((__packed__)) lightranger9_partial_type {
+    uint8_t result_number;
+    uint8_t sub_capture;
+    uint8_t zones;
+    uint8_t count;
+    uint8_t zone[LIGHTRANGER9_PARTIAL_MAX_ZONES];
+    lightranger9_meas_result_t obj1[LIGHTRANGER9_PARTIAL_MAX_ZONES];
+    lightranger9_meas_result_t obj2[LIGHTRANGER9_PARTIAL_MAX_ZONES];
+} lightranger9_partial_t;
+
 /**
  * @brief Gets measurements from sensor.
  * This is not the correct way of getting data from the sensor
@@ -556,22 +946,321 @@ void lightranger9_clear_ints(const struct device *dev);
  * @brief Gets interrupt status pin
  * 
  * @param dev  sensor device.
- * @return     true if pin high (still on measurement) otherwise false.
+ * @return     true if pin high (still on measurement) otherwise false,
+ *             always false while replaying.
  */
 bool lightranger9_get_interrupt_pin(const struct device *dev);
 
+/**
+ * @brief Checks that a device is a LightRanger9 sensor, e.g. before
+ * handing a device looked up by name to the functions of this driver.
+ * 
+ * @param dev  device to check.
+ * @return     true if the device is driven by this driver otherwise false.
+ */
+bool lightranger9_is_device(const struct device *dev);
+
 /**
  * @brief Parses measurements from caprtures.
  * NOTE: for a single measurements 4 discrete captures are required.
+ * Captures are placed by their sub-capture and result number, a frame
+ * missing a sub-capture is discarded once the next frame starts.
  * 
+ * @param dev           sensor device the capture came from.
  * @param capture       a capture to convert.
  * @param measurements  parsed measurement.
  * @return              true if we parsed 4 captures to a single complete
  *                      measurement otherwise false.
  */
-bool lightranger9_parse_measurement(lightranger9_meas_cpt_t *capture,
+bool lightranger9_parse_measurement(const struct device *dev,
+                                    lightranger9_meas_cpt_t *capture,
                                     lightranger9_measurement_t *measurements);
 
+/**
+ * @brief Decodes the last fetched capture straight from the raw block
+ * into its zones of a frame, without going through a capture struct.
+ * Zones not covered by the capture are left untouched, so the same frame
+ * must be passed for all 4 captures and needs no clearing in between.
+ * Frame assembly follows lightranger9_parse_measurement().
+ * With CONFIG_LIGHTRANGER9_ADAPTIVE_ITERATIONS a completed frame may
+ * pick a new integration time, which the trigger thread applies between
+ * frames.
+ * 
+ * @param dev    sensor device, after a successful sensor_sample_fetch().
+ * @param frame  frame being assembled.
+ * @return       true if the capture completed the frame otherwise false.
+ */
+bool lightranger9_decode_frame(const struct device *dev,
+                               lightranger9_measurement_t *frame);
+
+/**
+ * @brief Decodes the last fetched capture on its own, for consumers that
+ * update their zone maps per sub-capture instead of waiting for a frame.
+ * Does not take part in frame assembly.
+ * 
+ * @param dev      sensor device, after a successful sensor_sample_fetch().
+ * @param partial  zones of the capture.
+ * @return         true, the capture is decoded with the zone mode in use.
+ */
+bool lightranger9_decode_partial(const struct device *dev,
+                                 lightranger9_partial_t *partial);
+
+/**
+ * @brief Gets the capture time of the last fetched capture.
+ * 
+ * @param dev  sensor device.
+ * @return     k_cycle_get_32() value when the sensor signalled the capture.
+ */
+uint32_t lightranger9_get_timestamp(const struct device *dev);
+
+/**
+ * @brief Encodes the last fetched capture. The encoded form is the raw
+ * result registers plus capture time and confidence threshold, it can be
+ * queued or batched cheaply and decoded later by whoever needs the values.
+ * 
+ * @param dev  sensor device, after a successful sensor_sample_fetch().
+ * @param enc  encoded capture to fill.
+ */
+void lightranger9_encode(const struct device *dev, lightranger9_encoded_capture_t *enc);
+
+/**
+ * @brief Decodes a scalar channel from an encoded capture, the same
+ * channels sensor_channel_get() supports for the last fetched capture:
+ * SENSOR_CHAN_DIE_TEMP and the LIGHTRANGER9_SENSOR_CHAN_* channels.
+ * 
+ * @param enc   encoded capture.
+ * @param chan  channel to decode.
+ * @param val   decoded value.
+ * @return      0 on success, -ENOTSUP for unsupported channels.
+ */
+int lightranger9_decode(const lightranger9_encoded_capture_t *enc,
+                        enum sensor_channel chan,
+                        struct sensor_value *val);
+
+/**
+ * @brief Decodes the distance of one zone from an encoded capture.
+ * 
+ * @param enc   encoded capture.
+ * @param zone  zone of the 8x8 map, row * 8 + col.
+ * @param obj   0 for the closest object, 1 for the second one.
+ * @param val   distance in meters, 0 if below the confidence threshold.
+ * @return      0 on success, -ENODATA if the zone is measured
+ *              by another sub-capture, -EINVAL on bad arguments.
+ */
+int lightranger9_decode_zone(const lightranger9_encoded_capture_t *enc,
+                             uint8_t zone,
+                             uint8_t obj,
+                             struct sensor_value *val);
+
+/**
+ * @brief Gets the capture FIFO statistics.
+ * 
+ * @param dev    sensor device.
+ * @param stats  statistics to fill.
+ */
+void lightranger9_get_fifo_stats(const struct device *dev, lightranger9_fifo_stats_t *stats);
+
+/**
+ * @brief Gets the frame assembly statistics: completed frames, partial
+ * frames discarded and sub-captures dropped as duplicate or out of range.
+ * 
+ * @param dev    sensor device.
+ * @param stats  statistics to fill.
+ */
+void lightranger9_get_frame_stats(const struct device *dev, lightranger9_frame_stats_t *stats);
+
+/**
+ * @brief Gets the fault recovery statistics. A failed capture read counts
+ * as a fault, after which the bus is recovered and the measurement is
+ * restarted on the running application (resync) or, if the sensor lost
+ * it, the sensor is initialized again (reinit). last_recovery_ms and
+ * max_recovery_ms measure from the fault to the next capture fetched.
+ * 
+ * @param dev    sensor device.
+ * @param stats  statistics to fill.
+ */
+void lightranger9_get_fault_stats(const struct device *dev, lightranger9_fault_stats_t *stats);
+
+#ifdef CONFIG_LIGHTRANGER9_BUS_STATS
+/**
+ * @brief Gets the I2C transaction counters, failures and latency
+ * histograms of the sensor, per transaction type.
+ * 
+ * @param dev    sensor device.
+ * @param stats  statistics to fill.
+ */
+void lightranger9_get_bus_stats(const struct device *dev, lightranger9_bus_stats_t *stats);
+
+/**
+ * @brief Clears the I2C transaction statistics.
+ * 
+ * @param dev  sensor device.
+ */
+void lightranger9_reset_bus_stats(const struct device *dev);
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION
+/**
+ * @brief Runs the sensor factory calibration, stores the result in
+ * settings and applies it. Measurement is stopped meanwhile.
+ * NOTE: the sensor must have no target within 40 cm in its field of view
+ * and little ambient light, e.g. facing the open room or covered by a
+ * dark, non reflective cover at a distance.
+ * Only supported in LIGHTRANGER9_ZONE_MODE_8X8.
+ * 
+ * @param dev  sensor device.
+ * @return     0 on success, -ENOTSUP in another zone mode
+ *             else negative error on failure
+ */
+int lightranger9_factory_calibrate(const struct device *dev);
+
+/**
+ * @brief Tells whether a factory calibration is applied.
+ * 
+ * @param dev  sensor device.
+ * @return     true if a stored calibration was loaded or captured.
+ */
+bool lightranger9_is_calibrated(const struct device *dev);
+#endif
+
+#ifdef CONFIG_PM_DEVICE
+/**
+ * @brief Gets the power management statistics. Time spent active and in
+ * standby is accounted up to now, charge_per_frame_uc estimates the sensor
+ * charge per completed frame from the configured supply currents.
+ * 
+ * @param dev    sensor device.
+ * @param stats  statistics to fill.
+ */
+void lightranger9_get_pm_stats(const struct device *dev, lightranger9_pm_stats_t *stats);
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_CAPTURE_STORE
+/**
+ * @brief Opens the lightranger9_captures partition, erasing it when
+ * recording. Called once by the driver during initialization.
+ *
+ * @param dev  sensor device.
+ * @return     0 on success else negative error on failure
+ */
+int lightranger9_store_init(const struct device *dev);
+
+#ifdef CONFIG_LIGHTRANGER9_RECORD
+/**
+ * @brief Appends a raw capture to the recording, nothing is written once
+ * the partition is full.
+ *
+ * @param dev    sensor device.
+ * @param block  capture as read from LIGHTRANGER9_REG_BLOCKREAD.
+ */
+void lightranger9_record_write(const struct device *dev, const uint8_t *block);
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_REPLAY
+/**
+ * @brief Reads the next recorded capture, starting over at the end of
+ * the recording. With CONFIG_LIGHTRANGER9_REPLAY_REALTIME it blocks until
+ * the capture is due.
+ *
+ * @param dev        sensor device.
+ * @param block      capture to fill, LIGHTRANGER9_BLOCKREAD_SIZE bytes.
+ * @param zone_mode  zone mode the capture was recorded in.
+ * @return           0 on success, -ENODATA if nothing was recorded
+ *                   else negative error on failure
+ */
+int lightranger9_replay_read(const struct device *dev, uint8_t *block, uint8_t *zone_mode);
+#endif
+#endif /* CONFIG_LIGHTRANGER9_CAPTURE_STORE */
+
+#ifdef CONFIG_LIGHTRANGER9_TRIGGER
+/**
+ * @brief Reads the pending capture from the sensor into the driver's
+ * FIFO, from which sensor_sample_fetch() takes it.
+ * Called by the driver's trigger thread, so the bus transfer of a capture
+ * overlaps with the decoding of the previous one in the application.
+ *
+ * @param dev  sensor device.
+ * @return     0 on success, -ENODATA when no capture was ready
+ *             else negative error on failure
+ */
+int lightranger9_acquire_capture(const struct device *dev);
+
+/**
+ * @brief Runs the fault recovery of a failed capture read again, without
+ * counting a new fault. Called by the driver's trigger thread while a
+ * recovery keeps failing, since the sensor raises no interrupt meanwhile.
+ *
+ * @param dev  sensor device.
+ * @return     -EAGAIN once recovered else negative error on failure
+ */
+int lightranger9_retry_recovery(const struct device *dev);
+
+/**
+ * @brief Fetches and decodes queued captures into a frame until the frame
+ * is complete or the FIFO is empty. Lets a consumer that was busy for a
+ * while catch up on everything the driver queued meanwhile.
+ *
+ * @param dev        sensor device.
+ * @param frame      frame being assembled, see lightranger9_decode_frame().
+ * @param timestamp  if not NULL, set to the capture time of the
+ *                   sub-capture completing the frame.
+ * @return           true if a frame was completed, call again to drain
+ *                   the rest, otherwise false.
+ */
+bool lightranger9_fifo_drain(const struct device *dev,
+                             lightranger9_measurement_t *frame,
+                             uint32_t *timestamp);
+
+/**
+ * @brief Sets up the interrupt pin callback used for data ready triggers.
+ * Called once by the driver during initialization.
+ *
+ * @param dev  sensor device.
+ * @return     0 on success else negative error on failure
+ */
+int lightranger9_init_interrupt(const struct device *dev);
+
+/**
+ * @brief Sets a data ready trigger handler (sensor_trigger_set() API).
+ * The handler is called from the driver's trigger thread every time the
+ * sensor signals a new capture on its interrupt pin.
+ *
+ * @param dev      sensor device.
+ * @param trig     trigger to set, only SENSOR_TRIG_DATA_READY is supported.
+ * @param handler  handler to call, NULL disables the trigger.
+ * @return         0 on success else negative error on failure
+ */
+int lightranger9_trigger_set(const struct device *dev,
+                             const struct sensor_trigger *trig,
+                             sensor_trigger_handler_t handler);
+
+/**
+ * @brief Hands a still pending sensor interrupt to the trigger thread.
+ * Edges are missed while the interrupt is disabled, so this is called
+ * whenever it is enabled again or a stalled capture can be serviced.
+ *
+ * @param dev  sensor device.
+ */
+void lightranger9_trigger_kick(const struct device *dev);
+
+#ifdef CONFIG_LIGHTRANGER9_HISTOGRAMS
+/**
+ * @brief Takes the oldest raw histogram packet from the driver's ring.
+ * Packets are only produced while LIGHTRANGER9_SENSOR_ATTR_HISTOGRAMS is on.
+ * A histogram channel is spread over several packets, see the TMF8828
+ * datasheet for the meaning of the subpacket number and config fields.
+ *
+ * @param dev      sensor device.
+ * @param packet   packet to fill.
+ * @param timeout  time to wait for a packet.
+ * @return         0 on success, -EAGAIN if no packet arrived in time
+ */
+int lightranger9_hist_get(const struct device *dev,
+                          lightranger9_hist_packet_t *packet,
+                          k_timeout_t timeout);
+#endif
+#endif /* CONFIG_LIGHTRANGER9_TRIGGER */
+
 #ifdef __cplusplus
 }
 #endif
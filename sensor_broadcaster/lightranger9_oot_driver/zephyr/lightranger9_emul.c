@@ -0,0 +1,518 @@
+/*
+ * Copyright 2023 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * TMF8828 emulator for the I2C and GPIO emulators.
+ *
+ * Models the parts of the sensor the driver relies on: the bootloader
+ * accepting the firmware download, the measurement application with its
+ * common and factory calibration pages, and synthetic result blocks
+ * produced every measurement period while measuring. A pending result
+ * pulls the INT line low until the interrupt status is cleared.
+ *
+ * The enable line is sampled on every transaction and capture, a power
+ * cycle in between two of them goes unnoticed.
+ */
+
+#define DT_DRV_COMPAT mikroe_lightranger9
+
+#include <device.h>
+#include <kernel.h>
+#include <string.h>
+#include <drivers/emul.h>
+#include <drivers/gpio.h>
+#include <drivers/gpio/gpio_emul.h>
+#include <drivers/i2c.h>
+#include <drivers/i2c_emul.h>
+#include <logging/log.h>
+#include <sys/byteorder.h>
+
+#include "lightranger9.h"
+
+LOG_MODULE_REGISTER(LIGHTRANGER9_EMUL, CONFIG_SENSOR_LOG_LEVEL);
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+
+#define EMUL_REGS_SIZE              256
+#define EMUL_PAGE_SIZE              LIGHTRANGER9_BLOCKREAD_SIZE
+#define EMUL_PAGE_OFFSET(reg)       ((reg) - LIGHTRANGER9_REG_CONFIG_RESULT)
+
+// version reported by the emulated measurement application
+#define EMUL_APP_MINOR              1
+#define EMUL_APP_PATCH              0
+
+#define EMUL_DEFAULT_PERIOD_MS      33
+#define EMUL_SYS_TICKS_PER_MS       5000
+#define EMUL_TEMPERATURE            25
+#define EMUL_AMBIENT                1000
+#define EMUL_OBJ_RESULTS            18
+#define EMUL_RESULT_SIZE            3
+#define EMUL_ZONE_STEP_MM           8
+#define EMUL_SWEEP_STEP_MM          16
+#define EMUL_SWEEP_FRAMES           32
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+
+typedef struct lightranger9_emul_data_type {
+    struct i2c_emul emul_i2c;
+    const struct lightranger9_emul_cfg_type *cfg;
+    struct k_timer timer;
+    struct k_spinlock lock;
+    uint8_t regs[EMUL_REGS_SIZE];
+    uint8_t common_page[EMUL_PAGE_SIZE];
+    uint8_t fc_page[EMUL_PAGE_SIZE];
+    uint32_t ram_bytes;
+    uint32_t sys_tick;
+    uint8_t result_number;
+    uint8_t sub_capture;
+    uint8_t results;
+    bool powered;
+    bool measuring;
+    bool tmf8820;
+} lightranger9_emul_data_t;
+
+typedef struct lightranger9_emul_cfg_type {
+    uint16_t addr;
+    const struct device *gpio;
+    gpio_pin_t enable_pin;
+    gpio_pin_t int_pin;
+    lightranger9_emul_data_t *data;
+} lightranger9_emul_cfg_t;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+static void lightranger9_emul_update_int(lightranger9_emul_data_t *data)
+{
+    const lightranger9_emul_cfg_t *cfg = data->cfg;
+    bool asserted = (data->regs[LIGHTRANGER9_REG_INT_STATUS] &
+                     data->regs[LIGHTRANGER9_REG_INT_ENAB]) != 0;
+
+    // open drain, active low; fails until the driver configured the pin
+    (void)gpio_emul_input_set(cfg->gpio, cfg->int_pin, asserted ? 0 : 1);
+}
+
+static void lightranger9_emul_default_page(lightranger9_emul_data_t *data)
+{
+    uint8_t *page = data->common_page;
+
+    data->regs[LIGHTRANGER9_REG_MODE] = data->tmf8820 ? LIGHTRANGER9_MODE_TMF8820 : LIGHTRANGER9_MODE_TMF8828;
+
+    memset(page, 0, EMUL_PAGE_SIZE);
+    page[0] = LIGHTRANGER9_CONFIG_RESULT_COMMON_CID;
+    sys_put_le16(EMUL_PAGE_SIZE - 4, &page[2]);
+    sys_put_le16(EMUL_DEFAULT_PERIOD_MS, &page[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_PERIOD_MS_LSB)]);
+    sys_put_le16(LIGHTRANGER9_DEFAULT_KILO_ITERATIONS,
+                 &page[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_KILO_ITERATIONS_LSB)]);
+
+    memset(data->fc_page, 0, EMUL_PAGE_SIZE);
+    data->fc_page[0] = LIGHTRANGER9_CONFIG_RESULT_FAC_CALIB_CID;
+    sys_put_le16(EMUL_PAGE_SIZE - 4, &data->fc_page[2]);
+}
+
+static void lightranger9_emul_stop(lightranger9_emul_data_t *data)
+{
+    data->measuring = false;
+    k_timer_stop(&data->timer);
+}
+
+static void lightranger9_emul_bl_status(lightranger9_emul_data_t *data, uint8_t status)
+{
+    // status, payload size and checksum, as read by the driver
+    data->regs[LIGHTRANGER9_REG_CMD_STAT]     = status;
+    data->regs[LIGHTRANGER9_REG_CMD_STAT + 1] = 0;
+    data->regs[LIGHTRANGER9_REG_CMD_STAT + 2] = (uint8_t)~status;
+}
+
+static void lightranger9_emul_power_up(lightranger9_emul_data_t *data)
+{
+    memset(data->regs, 0, sizeof(data->regs));
+    data->regs[LIGHTRANGER9_REG_APPID] = LIGHTRANGER9_APP_ID_BOOTLOADER;
+    data->regs[LIGHTRANGER9_REG_ID]    = LIGHTRANGER9_DEVICE_ID;
+    lightranger9_emul_bl_status(data, LIGHTRANGER9_BL_CMD_STAT_READY);
+
+    data->ram_bytes = 0;
+    data->sys_tick = 0;
+    data->result_number = 0;
+    data->sub_capture = 0;
+    data->results = 0;
+    data->tmf8820 = false;
+    data->powered = true;
+}
+
+static bool lightranger9_emul_check_power(lightranger9_emul_data_t *data)
+{
+    const lightranger9_emul_cfg_t *cfg = data->cfg;
+    bool enabled = (gpio_emul_output_get(cfg->gpio, cfg->enable_pin) == 1);
+
+    if (enabled && !data->powered) {
+        lightranger9_emul_power_up(data);
+    } else if (!enabled && data->powered) {
+        // everything in RAM is lost, the next power up starts in the bootloader
+        lightranger9_emul_stop(data);
+        data->powered = false;
+        data->regs[LIGHTRANGER9_REG_INT_STATUS] = 0;
+    } else {
+        // do nothing
+    }
+
+    return enabled;
+}
+
+static void lightranger9_emul_app_start(lightranger9_emul_data_t *data)
+{
+    memset(data->regs, 0, LIGHTRANGER9_REG_ENABLE);
+    data->regs[LIGHTRANGER9_REG_APPID]  = LIGHTRANGER9_APP_ID_MEASUREMENT;
+    data->regs[LIGHTRANGER9_REG_MINOR]  = EMUL_APP_MINOR;
+    data->regs[LIGHTRANGER9_REG_PATCH]  = EMUL_APP_PATCH;
+    data->regs[LIGHTRANGER9_REG_ENABLE] = LIGHTRANGER9_ENABLE_PON | LIGHTRANGER9_ENABLE_CPU_READY;
+    lightranger9_emul_default_page(data);
+
+    LOG_DBG("Measurement application started after %u bytes", data->ram_bytes);
+}
+
+static void lightranger9_emul_bl_frame(lightranger9_emul_data_t *data,
+                                       const uint8_t *frame,
+                                       uint32_t len)
+{
+    uint8_t status = LIGHTRANGER9_BL_CMD_STAT_READY;
+    uint8_t sum = 0;
+    uint32_t i;
+
+    if ((len < 3) || (len != (uint32_t)frame[1] + 3)) {
+        lightranger9_emul_bl_status(data, LIGHTRANGER9_BL_CMD_STAT_ERR_SIZE);
+        return;
+    }
+
+    for (i = 0; i < (len - 1); i++) {
+        sum += frame[i];
+    }
+    if ((uint8_t)~sum != frame[len - 1]) {
+        lightranger9_emul_bl_status(data, LIGHTRANGER9_BL_CMD_STAT_ERR_CSUM);
+        return;
+    }
+
+    switch (frame[0]) {
+    case LIGHTRANGER9_BL_CMD_DOWNLOAD_INIT:
+        data->ram_bytes = 0;
+        break;
+    case LIGHTRANGER9_BL_CMD_ADDR_RAM:
+        status = (frame[1] == 2) ? LIGHTRANGER9_BL_CMD_STAT_READY : LIGHTRANGER9_BL_CMD_STAT_ERR_SIZE;
+        break;
+    case LIGHTRANGER9_BL_CMD_W_RAM:
+        data->ram_bytes += frame[1];
+        break;
+    case LIGHTRANGER9_BL_CMD_RAMREMAP_RESET:
+        if (data->ram_bytes > 0) {
+            lightranger9_emul_app_start(data);
+            return;
+        }
+        status = LIGHTRANGER9_BL_CMD_STAT_ERR_RANGE;
+        break;
+    case LIGHTRANGER9_BL_CMD_RAM_BIST:
+    case LIGHTRANGER9_BL_CMD_I2C_BIST:
+        break;
+    default:
+        status = LIGHTRANGER9_BL_CMD_STAT_ERR_RANGE;
+        break;
+    }
+
+    lightranger9_emul_bl_status(data, status);
+}
+
+static void lightranger9_emul_load_page(lightranger9_emul_data_t *data, const uint8_t *page)
+{
+    memcpy(&data->regs[LIGHTRANGER9_REG_CONFIG_RESULT], page, EMUL_PAGE_SIZE);
+}
+
+static uint8_t lightranger9_emul_write_page(lightranger9_emul_data_t *data)
+{
+    uint8_t *page;
+
+    switch (data->regs[LIGHTRANGER9_REG_CONFIG_RESULT]) {
+    case LIGHTRANGER9_CONFIG_RESULT_COMMON_CID:
+        page = data->common_page;
+        break;
+    case LIGHTRANGER9_CONFIG_RESULT_FAC_CALIB_CID:
+        page = data->fc_page;
+        break;
+    default:
+        return LIGHTRANGER9_CMD_ERR_UNKNOWN_CID;
+    }
+
+    memcpy(page, &data->regs[LIGHTRANGER9_REG_CONFIG_RESULT], EMUL_PAGE_SIZE);
+
+    return LIGHTRANGER9_CMD_STAT_OK;
+}
+
+static uint8_t lightranger9_emul_sub_captures(const lightranger9_emul_data_t *data)
+{
+    if (!data->tmf8820) {
+        return LIGHTRANGER9_SUBCAPTURE_3 + 1;
+    } else if (data->common_page[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_SPAD_MAP_ID)] == LIGHTRANGER9_SPAD_MAP_4X4) {
+        return 2;
+    } else {
+        return 1;
+    }
+}
+
+static void lightranger9_emul_measure(lightranger9_emul_data_t *data)
+{
+    uint16_t period_ms = sys_get_le16(&data->common_page[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_PERIOD_MS_LSB)]);
+
+    // every sub-capture is a measurement of its own
+    period_ms = MAX(period_ms, 1);
+    data->sub_capture = 0;
+    data->results = 0;
+    data->measuring = true;
+    k_timer_start(&data->timer, K_MSEC(period_ms), K_MSEC(period_ms));
+}
+
+static void lightranger9_emul_app_cmd(lightranger9_emul_data_t *data, uint8_t cmd)
+{
+    uint8_t status = LIGHTRANGER9_CMD_STAT_OK;
+
+    switch (cmd) {
+    case LIGHTRANGER9_CMD_STAT_MEASURE:
+        lightranger9_emul_measure(data);
+        status = LIGHTRANGER9_CMD_STAT_ACCEPTED;
+        break;
+    case LIGHTRANGER9_CMD_STAT_STOP:
+        lightranger9_emul_stop(data);
+        break;
+    case LIGHTRANGER9_CMD_STAT_LOAD_CFG_PAGE_COMMON:
+        lightranger9_emul_load_page(data, data->common_page);
+        break;
+    case LIGHTRANGER9_CMD_STAT_LOAD_CFG_PAGE_F_Y_CAL:
+        lightranger9_emul_load_page(data, data->fc_page);
+        break;
+    case LIGHTRANGER9_CMD_STAT_WRITE_CFG_PAGE:
+        status = lightranger9_emul_write_page(data);
+        break;
+    case LIGHTRANGER9_CMD_STAT_RESET_FACTORY_CAL:
+        memset(&data->fc_page[4], 0, EMUL_PAGE_SIZE - 4);
+        break;
+    case LIGHTRANGER9_CMD_STAT_FORCE_TMF8820:
+    case LIGHTRANGER9_CMD_STAT_FORCE_TMF8828:
+        data->tmf8820 = (cmd == LIGHTRANGER9_CMD_STAT_FORCE_TMF8820);
+        lightranger9_emul_default_page(data);
+        break;
+    case LIGHTRANGER9_CMD_STAT_CLEAR_STATUS:
+    case LIGHTRANGER9_CMD_STAT_FACTORY_CALIBRATION:
+    case LIGHTRANGER9_CMD_STAT_GPIO:
+        break;
+    default:
+        status = LIGHTRANGER9_CMD_ERR_UNKNOWN_CMD;
+        break;
+    }
+
+    data->regs[LIGHTRANGER9_REG_PREV_CMD] = cmd;
+    data->regs[LIGHTRANGER9_REG_CMD_STAT] = status;
+}
+
+static void lightranger9_emul_capture(lightranger9_emul_data_t *data)
+{
+    uint8_t *block = &data->regs[LIGHTRANGER9_REG_BLOCKREAD];
+    uint16_t period_ms = sys_get_le16(&data->common_page[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_PERIOD_MS_LSB)]);
+    uint16_t kilo = sys_get_le16(&data->common_page[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_KILO_ITERATIONS_LSB)]);
+    uint8_t confidence = (uint8_t)(((uint32_t)kilo * 255) / ((uint32_t)kilo + 256));
+    uint8_t tid = data->regs[LIGHTRANGER9_REG_TID] + 1;
+    uint8_t *result;
+    uint16_t distance;
+    uint8_t i;
+
+    memset(block, 0, EMUL_PAGE_SIZE);
+    block[0] = LIGHTRANGER9_CONFIG_RESULT_MEAS;
+    block[1] = tid;
+    sys_put_le16(EMUL_PAGE_SIZE - 4, &block[2]);
+    /**
+     * The TMF8828 numbers frames and their sub-captures, a TMF8820 counts
+     * results from the start of the measurement. Its 4x4 SPAD halves take
+     * turns, so the first half always gets the even results.
+     */
+    if (data->tmf8820) {
+        block[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_RESULT_NUMBER)] = data->results;
+    } else {
+        block[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_RESULT_NUMBER)] = (data->result_number << 2) | data->sub_capture;
+    }
+    block[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_TEMPERATURE)] = EMUL_TEMPERATURE;
+    block[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_NUMBER_VALID_RESULTS)] = EMUL_OBJ_RESULTS;
+    sys_put_le32(EMUL_AMBIENT, &block[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_AMBIENT_LIGHT_0)]);
+    sys_put_le32((uint32_t)kilo * 100, &block[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_PHOTON_COUNT_0)]);
+    sys_put_le32((uint32_t)kilo * 4, &block[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_REFERENCE_COUNT_0)]);
+    sys_put_le32(data->sys_tick, &block[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_SYS_TICK_0)]);
+
+    /**
+     * A tilted plane moving away over EMUL_SWEEP_FRAMES frames, only the
+     * first object of each channel is reported. Confidence grows with the
+     * integration time so the adaptive iterations have something to follow.
+     */
+    for (i = 0; i < EMUL_OBJ_RESULTS; i++) {
+        result = &block[EMUL_PAGE_OFFSET(LIGHTRANGER9_REG_RES_CONFIDENCE_0) + (i * EMUL_RESULT_SIZE)];
+        distance = CONFIG_EMUL_LIGHTRANGER9_DISTANCE_MM +
+                   (((data->sub_capture * EMUL_OBJ_RESULTS) + i) * EMUL_ZONE_STEP_MM) +
+                   ((data->result_number % EMUL_SWEEP_FRAMES) * EMUL_SWEEP_STEP_MM);
+        result[0] = confidence;
+        sys_put_le16(distance, &result[1]);
+    }
+
+    data->sys_tick += (uint32_t)period_ms * EMUL_SYS_TICKS_PER_MS;
+    data->results++;
+    data->sub_capture++;
+    if (data->sub_capture >= lightranger9_emul_sub_captures(data)) {
+        data->sub_capture = 0;
+        data->result_number = (data->result_number + 1) & LIGHTRANGER9_RESULT_NUMBER_MASK;
+    } else {
+        // do nothing
+    }
+
+    data->regs[LIGHTRANGER9_REG_INT_STATUS] |= LIGHTRANGER9_INT_STATUS_MEAS_READY;
+}
+
+static void lightranger9_emul_timer(struct k_timer *timer)
+{
+    lightranger9_emul_data_t *data = CONTAINER_OF(timer, lightranger9_emul_data_t, timer);
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+    if (!lightranger9_emul_check_power(data) || !data->measuring) {
+        // do nothing
+    } else if (data->regs[LIGHTRANGER9_REG_INT_STATUS] & LIGHTRANGER9_INT_STATUS_MEAS_READY) {
+        // the previous result was not picked up in time, skip this one
+        LOG_DBG("Sub-capture %u dropped", data->sub_capture);
+    } else {
+        lightranger9_emul_capture(data);
+    }
+
+    lightranger9_emul_update_int(data);
+    k_spin_unlock(&data->lock, key);
+}
+
+static int lightranger9_emul_write(lightranger9_emul_data_t *data,
+                                   uint8_t reg,
+                                   const uint8_t *buf,
+                                   uint32_t len)
+{
+    if (((uint32_t)reg + len) > EMUL_REGS_SIZE) {
+        return -EIO;
+    }
+    if (len == 0) {
+        return 0;
+    }
+
+    switch (reg) {
+    case LIGHTRANGER9_REG_CMD_STAT:
+        if (data->regs[LIGHTRANGER9_REG_APPID] == LIGHTRANGER9_APP_ID_BOOTLOADER) {
+            lightranger9_emul_bl_frame(data, buf, len);
+        } else {
+            lightranger9_emul_app_cmd(data, buf[0]);
+        }
+        break;
+    case LIGHTRANGER9_REG_ENABLE:
+        if (buf[0] & LIGHTRANGER9_ENABLE_PON) {
+            data->regs[reg] = LIGHTRANGER9_ENABLE_PON | LIGHTRANGER9_ENABLE_CPU_READY;
+        } else {
+            // standby, the application and its pages stay in RAM
+            lightranger9_emul_stop(data);
+            data->regs[reg] = LIGHTRANGER9_ENABLE_STANDBY;
+        }
+        break;
+    case LIGHTRANGER9_REG_INT_STATUS:
+        data->regs[reg] &= ~buf[0];
+        break;
+    default:
+        memcpy(&data->regs[reg], buf, len);
+        break;
+    }
+
+    return 0;
+}
+
+static int lightranger9_emul_transfer(struct i2c_emul *emul,
+                                      struct i2c_msg *msgs,
+                                      int num_msgs,
+                                      int addr)
+{
+    lightranger9_emul_data_t *data = CONTAINER_OF(emul, lightranger9_emul_data_t, emul_i2c);
+    k_spinlock_key_t key;
+    uint8_t reg;
+    int ret;
+
+    ARG_UNUSED(addr);
+
+    // register address write, optionally followed by a repeated start read
+    if ((num_msgs < 1) || (num_msgs > 2) ||
+        (msgs[0].flags & I2C_MSG_READ) || (msgs[0].len < 1)) {
+        LOG_ERR("Unsupported transfer");
+        return -EIO;
+    }
+
+    reg = msgs[0].buf[0];
+    key = k_spin_lock(&data->lock);
+
+    if (!lightranger9_emul_check_power(data)) {
+        // powered down, the address is not acknowledged
+        ret = -EIO;
+    } else if (num_msgs == 1) {
+        ret = lightranger9_emul_write(data, reg, &msgs[0].buf[1], msgs[0].len - 1);
+    } else if ((msgs[1].flags & I2C_MSG_READ) && (((uint32_t)reg + msgs[1].len) <= EMUL_REGS_SIZE)) {
+        memcpy(msgs[1].buf, &data->regs[reg], msgs[1].len);
+        ret = 0;
+    } else {
+        ret = -EIO;
+    }
+
+    lightranger9_emul_update_int(data);
+    k_spin_unlock(&data->lock, key);
+
+    return ret;
+}
+
+static const struct i2c_emul_api lightranger9_emul_api = {
+    .transfer = lightranger9_emul_transfer,
+};
+
+static int lightranger9_emul_init(const struct emul *emul, const struct device *parent)
+{
+    const lightranger9_emul_cfg_t *cfg = emul->cfg;
+    lightranger9_emul_data_t *data = cfg->data;
+
+    data->cfg = cfg;
+    data->emul_i2c.api = &lightranger9_emul_api;
+    data->emul_i2c.addr = cfg->addr;
+    k_timer_init(&data->timer, lightranger9_emul_timer, NULL);
+
+    return i2c_emul_register(parent, emul->dev_label, &data->emul_i2c);
+}
+
+#define LIGHTRANGER9_EMUL(inst)                                                             \
+    static lightranger9_emul_data_t lightranger9_emul_data_##inst;                          \
+                                                                                            \
+    static const lightranger9_emul_cfg_t lightranger9_emul_cfg_##inst = {                   \
+        .addr = DT_INST_REG_ADDR(inst),                                                     \
+        .gpio = DEVICE_DT_GET(DT_GPIO_CTLR(DT_DRV_INST(inst), control_gpios)),              \
+        .enable_pin = DT_INST_GPIO_PIN_BY_IDX(inst, control_gpios, 0),                      \
+        .int_pin = DT_INST_GPIO_PIN_BY_IDX(inst, control_gpios, 1),                         \
+        .data = &lightranger9_emul_data_##inst                                              \
+    };                                                                                      \
+                                                                                            \
+    EMUL_DEFINE(lightranger9_emul_init, DT_DRV_INST(inst), &lightranger9_emul_cfg_##inst)
+
+DT_INST_FOREACH_STATUS_OKAY(LIGHTRANGER9_EMUL)
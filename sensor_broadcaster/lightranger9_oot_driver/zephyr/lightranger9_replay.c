@@ -0,0 +1,205 @@
+/*
+ * Copyright 2023 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define DT_DRV_COMPAT mikroe_lightranger9
+
+#include <device.h>
+#include <kernel.h>
+#include <string.h>
+#include <storage/flash_map.h>
+#include <logging/log.h>
+
+#include "lightranger9.h"
+
+LOG_MODULE_DECLARE(LIGHTRANGER9, CONFIG_SENSOR_LOG_LEVEL);
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+
+#define RECORD_MAGIC                0x394C
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/**
+ * A raw capture as stored back to back in the lightranger9_captures
+ * partition, the recording ends at the first erased record.
+ */
+typedef struct __attribute__((__packed__)) lightranger9_record_type {
+    uint16_t magic;
+    uint8_t zone_mode;
+    uint8_t reserved;
+    uint32_t stamp_ms;
+    uint8_t block[LIGHTRANGER9_BLOCKREAD_SIZE];
+} lightranger9_record_t;
+
+BUILD_ASSERT((sizeof(lightranger9_record_t) % 4) == 0,
+             "records must keep flash writes word aligned");
+
+/**
+ * Every instance would erase and append to the same partition
+ */
+BUILD_ASSERT(DT_NUM_INST_STATUS_OKAY(DT_DRV_COMPAT) == 1,
+             "recording and replay support a single LightRanger9 instance");
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+#ifdef CONFIG_LIGHTRANGER9_REPLAY
+static int lightranger9_replay_next(lightranger9_data_t *data, lightranger9_record_t *rec)
+{
+    int ret;
+
+    if ((data->store_offset + sizeof(*rec)) > data->store->fa_size) {
+        return -ENODATA;
+    }
+
+    ret = flash_area_read(data->store, data->store_offset, rec, sizeof(*rec));
+    if (ret) {
+        return ret;
+    } else if (rec->magic != RECORD_MAGIC) {
+        return -ENODATA;
+    } else {
+        data->store_offset += sizeof(*rec);
+    }
+
+    return 0;
+}
+#endif
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+int lightranger9_store_init(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    int ret;
+
+    data->store_offset = 0;
+
+    ret = flash_area_open(FLASH_AREA_ID(lightranger9_captures), &data->store);
+    if (ret) {
+        LOG_ERR("Capture partition not found (%d)!", ret);
+        data->store = NULL;
+        return ret;
+    }
+
+#ifdef CONFIG_LIGHTRANGER9_RECORD
+    // a new recording replaces the previous one
+    ret = flash_area_erase(data->store, 0, data->store->fa_size);
+    if (ret) {
+        LOG_ERR("Failed to erase capture partition (%d)!", ret);
+        flash_area_close(data->store);
+        data->store = NULL;
+    } else {
+        LOG_INF("Recording up to %u captures",
+                (uint32_t)(data->store->fa_size / sizeof(lightranger9_record_t)));
+    }
+#endif
+
+    return ret;
+}
+
+#ifdef CONFIG_LIGHTRANGER9_RECORD
+void lightranger9_record_write(const struct device *dev, const uint8_t *block)
+{
+    lightranger9_data_t *data = dev->data;
+    lightranger9_record_t rec;
+    int ret;
+
+    if ((data->store == NULL) ||
+        ((data->store_offset + sizeof(rec)) > data->store->fa_size)) {
+        return;
+    }
+
+    rec.magic     = RECORD_MAGIC;
+    rec.zone_mode = data->zone_mode;
+    rec.reserved  = 0;
+    rec.stamp_ms  = k_uptime_get_32();
+    memcpy(rec.block, block, sizeof(rec.block));
+
+    ret = flash_area_write(data->store, data->store_offset, &rec, sizeof(rec));
+    if (ret) {
+        LOG_ERR("Failed to record capture (%d), recording stopped!", ret);
+        data->store = NULL;
+        return;
+    }
+
+    data->store_offset += sizeof(rec);
+    if ((data->store_offset + sizeof(rec)) > data->store->fa_size) {
+        LOG_INF("Capture partition full, recording stopped");
+    } else {
+        // do nothing
+    }
+}
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_REPLAY
+int lightranger9_replay_read(const struct device *dev, uint8_t *block, uint8_t *zone_mode)
+{
+    lightranger9_data_t *data = dev->data;
+    lightranger9_record_t rec;
+    int ret;
+
+    if (data->store == NULL) {
+        return -ENODEV;
+    }
+
+    ret = lightranger9_replay_next(data, &rec);
+    if ((ret == -ENODATA) && (data->store_offset > 0)) {
+        // end of the recording, start over
+        LOG_DBG("Replay looped after %u captures",
+                (uint32_t)(data->store_offset / sizeof(rec)));
+        data->store_offset = 0;
+        ret = lightranger9_replay_next(data, &rec);
+    } else {
+        // do nothing
+    }
+    if (ret) {
+        return ret;
+    }
+
+#ifdef CONFIG_LIGHTRANGER9_REPLAY_REALTIME
+    /**
+     * Release each capture as long after the previous one as it was
+     * recorded, the pace restarts with the first one of the recording.
+     */
+    if (data->store_offset == sizeof(rec)) {
+        data->store_due_ms = k_uptime_get_32();
+    } else {
+        int32_t wait_ms;
+
+        data->store_due_ms += rec.stamp_ms - data->store_stamp_ms;
+        wait_ms = (int32_t)(data->store_due_ms - k_uptime_get_32());
+        if (wait_ms > 0) {
+            k_msleep(wait_ms);
+        } else {
+            // do nothing
+        }
+    }
+    data->store_stamp_ms = rec.stamp_ms;
+#endif
+
+    memcpy(block, rec.block, sizeof(rec.block));
+    *zone_mode = rec.zone_mode;
+
+    return 0;
+}
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2023 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <device.h>
+#include <kernel.h>
+#include <shell/shell.h>
+
+#include "lightranger9.h"
+
+/* ----------------------------------------------------------------
+ * VARIABLES
+ * -------------------------------------------------------------- */
+
+static const char *const lightranger9_bus_op_names[LIGHTRANGER9_BUS_OP_COUNT] = {
+    [LIGHTRANGER9_BUS_OP_BLOCK_READ] = "block read",
+    [LIGHTRANGER9_BUS_OP_REG_READ]   = "reg read",
+    [LIGHTRANGER9_BUS_OP_REG_WRITE]  = "reg write",
+    [LIGHTRANGER9_BUS_OP_BL_CMD]     = "bl cmd",
+};
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+static const struct device *lightranger9_shell_device(const struct shell *sh, const char *name)
+{
+    const struct device *dev = device_get_binding(name);
+
+    if (dev == NULL) {
+        shell_error(sh, "Device %s not found", name);
+    } else if (!lightranger9_is_device(dev)) {
+        shell_error(sh, "Device %s is not a LightRanger9 sensor", name);
+        dev = NULL;
+    } else {
+        // do nothing
+    }
+
+    return dev;
+}
+
+static int cmd_bus_stats(const struct shell *sh, size_t argc, char **argv)
+{
+    const struct device *dev = lightranger9_shell_device(sh, argv[1]);
+    lightranger9_bus_stats_t stats;
+    const lightranger9_bus_op_stats_t *op;
+    uint8_t i;
+    uint8_t b;
+
+    if (dev == NULL) {
+        return -ENODEV;
+    }
+
+    lightranger9_get_bus_stats(dev, &stats);
+
+    for (i = 0; i < LIGHTRANGER9_BUS_OP_COUNT; i++) {
+        op = &stats.op[i];
+        shell_print(sh, "%-10s count %u errors %u avg %u us max %u us",
+                    lightranger9_bus_op_names[i],
+                    op->count,
+                    op->errors,
+                    (op->count > 0) ? (uint32_t)(op->total_us / op->count) : 0,
+                    op->max_us);
+
+        // only the buckets that were hit, by upper bound
+        for (b = 0; b < LIGHTRANGER9_BUS_HIST_BUCKETS; b++) {
+            if (op->hist[b] == 0) {
+                continue;
+            }
+            if (b < (LIGHTRANGER9_BUS_HIST_BUCKETS - 1)) {
+                shell_print(sh, "  < %6u us: %u", 1U << b, op->hist[b]);
+            } else {
+                shell_print(sh, "  >=%6u us: %u", 1U << (b - 1), op->hist[b]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int cmd_bus_reset(const struct shell *sh, size_t argc, char **argv)
+{
+    const struct device *dev = lightranger9_shell_device(sh, argv[1]);
+
+    if (dev == NULL) {
+        return -ENODEV;
+    }
+
+    lightranger9_reset_bus_stats(dev);
+
+    return 0;
+}
+
+/* ----------------------------------------------------------------
+ * SHELL COMMANDS
+ * -------------------------------------------------------------- */
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_lightranger9,
+    SHELL_CMD_ARG(bus_stats, NULL, "Show I2C transaction statistics <device>", cmd_bus_stats, 2, 0),
+    SHELL_CMD_ARG(bus_reset, NULL, "Clear I2C transaction statistics <device>", cmd_bus_reset, 2, 0),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(lightranger9, &sub_lightranger9, "LightRanger9 sensor commands", NULL);
@@ -0,0 +1,246 @@
+/*
+ * Copyright 2023 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define DT_DRV_COMPAT mikroe_lightranger9
+
+#include <device.h>
+#include <kernel.h>
+#include <drivers/gpio.h>
+#include <drivers/sensor.h>
+#include <logging/log.h>
+
+#include "lightranger9.h"
+
+LOG_MODULE_DECLARE(LIGHTRANGER9, CONFIG_SENSOR_LOG_LEVEL);
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+
+/**
+ * Time between attempts while the fault recovery keeps failing
+ */
+#define RECOVERY_RETRY_MS           1000
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+static int lightranger9_set_int_enabled(const struct device *dev, bool enable)
+{
+    const lightranger9_config_t *cfg = dev->config;
+
+    /**
+     * The TMF8828 pulls its INT line low when a capture is ready
+     * and releases it once the interrupt status has been cleared.
+     */
+    return gpio_pin_interrupt_configure(cfg->control_ctrl,
+                                        cfg->int_pin,
+                                        enable ? GPIO_INT_EDGE_FALLING : GPIO_INT_DISABLE);
+}
+
+static void lightranger9_schedule_int(lightranger9_data_t *data)
+{
+    data->int_stamp = k_cycle_get_32();
+
+#if defined(CONFIG_LIGHTRANGER9_TRIGGER_OWN_THREAD)
+    k_sem_give(&data->gpio_sem);
+#elif defined(CONFIG_LIGHTRANGER9_TRIGGER_GLOBAL_THREAD)
+    k_work_submit(&data->work);
+#endif
+}
+
+static void lightranger9_handle_int(const struct device *dev)
+{
+    lightranger9_data_t *data = dev->data;
+    int ret = -ENODATA;
+
+    if (data->recover_pending) {
+        data->recover_pending = false;
+        ret = lightranger9_retry_recovery(dev);
+    } else if (data->drdy_handler != NULL) {
+        ret = lightranger9_acquire_capture(dev);
+        if (ret == 0) {
+            data->drdy_handler(dev, &data->drdy_trigger);
+        } else {
+            // do nothing
+        }
+    } else {
+        // do nothing
+    }
+
+    /**
+     * A full histogram ring leaves the interrupt pending and disabled,
+     * lightranger9_hist_get() kicks the thread once there is room again.
+     */
+    if (ret != -ENOBUFS) {
+        lightranger9_set_int_enabled(dev, true);
+        if ((ret == 0) || (ret == -EAGAIN)) {
+            // histogram packets can follow each other before we re-enable
+            lightranger9_trigger_kick(dev);
+        } else if (ret != -ENODATA) {
+            /**
+             * The recovery failed and a sensor stuck with INT low sends
+             * no further edge, try again later rather than waiting for one.
+             */
+            k_timer_start(&data->retry_timer, K_MSEC(RECOVERY_RETRY_MS), K_NO_WAIT);
+        } else {
+            // do nothing
+        }
+    } else {
+        // do nothing
+    }
+}
+
+static void lightranger9_retry_expiry(struct k_timer *timer)
+{
+    lightranger9_data_t *data = CONTAINER_OF(timer, lightranger9_data_t, retry_timer);
+
+    lightranger9_set_int_enabled(data->dev, false);
+    data->recover_pending = true;
+    lightranger9_schedule_int(data);
+}
+
+static void lightranger9_gpio_callback(const struct device *port,
+                                       struct gpio_callback *cb,
+                                       gpio_port_pins_t pins)
+{
+    lightranger9_data_t *data = CONTAINER_OF(cb, lightranger9_data_t, gpio_cb);
+
+    ARG_UNUSED(port);
+    ARG_UNUSED(pins);
+
+    lightranger9_set_int_enabled(data->dev, false);
+    lightranger9_schedule_int(data);
+}
+
+#if defined(CONFIG_LIGHTRANGER9_TRIGGER_OWN_THREAD)
+static void lightranger9_thread(void *p1, void *p2, void *p3)
+{
+    lightranger9_data_t *data = p1;
+
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    while (true) {
+        k_sem_take(&data->gpio_sem, K_FOREVER);
+        lightranger9_handle_int(data->dev);
+    }
+}
+#elif defined(CONFIG_LIGHTRANGER9_TRIGGER_GLOBAL_THREAD)
+static void lightranger9_work_cb(struct k_work *work)
+{
+    lightranger9_data_t *data = CONTAINER_OF(work, lightranger9_data_t, work);
+
+    lightranger9_handle_int(data->dev);
+}
+#endif
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+void lightranger9_trigger_kick(const struct device *dev)
+{
+    const lightranger9_config_t *cfg = dev->config;
+    lightranger9_data_t *data = dev->data;
+
+    if (gpio_pin_get(cfg->control_ctrl, cfg->int_pin) == 0) {
+        lightranger9_set_int_enabled(dev, false);
+        lightranger9_schedule_int(data);
+    } else {
+        // do nothing
+    }
+}
+
+int lightranger9_trigger_set(const struct device *dev,
+                             const struct sensor_trigger *trig,
+                             sensor_trigger_handler_t handler)
+{
+    lightranger9_data_t *data = dev->data;
+    int ret;
+
+    if (trig->type != SENSOR_TRIG_DATA_READY) {
+        return -ENOTSUP;
+    }
+
+    ret = lightranger9_set_int_enabled(dev, false);
+    if (ret) {
+        return ret;
+    }
+
+    data->drdy_handler = handler;
+    data->drdy_trigger = *trig;
+
+    if (handler == NULL) {
+        return 0;
+    }
+
+    ret = lightranger9_set_int_enabled(dev, true);
+
+    /**
+     * A capture may already be pending, in which case the INT line
+     * is low and no edge will come until it is serviced.
+     */
+    if (ret == 0) {
+        lightranger9_trigger_kick(dev);
+    } else {
+        // do nothing
+    }
+
+    return ret;
+}
+
+int lightranger9_init_interrupt(const struct device *dev)
+{
+    const lightranger9_config_t *cfg = dev->config;
+    lightranger9_data_t *data = dev->data;
+    int ret;
+
+    data->dev = dev;
+
+#if defined(CONFIG_LIGHTRANGER9_TRIGGER_OWN_THREAD)
+    // one pending wake up covers any number of edges, see handle_int()
+    k_sem_init(&data->gpio_sem, 0, 1);
+
+    k_thread_create(&data->thread,
+                    data->thread_stack,
+                    CONFIG_LIGHTRANGER9_THREAD_STACK_SIZE,
+                    lightranger9_thread,
+                    data, NULL, NULL,
+                    K_PRIO_PREEMPT(CONFIG_LIGHTRANGER9_THREAD_PRIORITY),
+                    0,
+                    K_NO_WAIT);
+    k_thread_name_set(&data->thread, dev->name);
+#elif defined(CONFIG_LIGHTRANGER9_TRIGGER_GLOBAL_THREAD)
+    k_work_init(&data->work, lightranger9_work_cb);
+#endif
+
+    k_timer_init(&data->retry_timer, lightranger9_retry_expiry, NULL);
+
+    gpio_init_callback(&data->gpio_cb,
+                       lightranger9_gpio_callback,
+                       BIT(cfg->int_pin));
+
+    ret = gpio_add_callback(cfg->control_ctrl, &data->gpio_cb);
+    if (ret) {
+        LOG_ERR("Failed to set interrupt pin callback!");
+    } else {
+        // do nothing
+    }
+
+    return ret;
+}
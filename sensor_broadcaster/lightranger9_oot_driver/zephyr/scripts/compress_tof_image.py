@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+#
+# Copyright 2023 u-blox Ltd
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Compress the TMF8828 firmware image for the LightRanger9 driver.
+
+Reads the tof_bin_image[] array from tof_bin_image.h and writes a header with
+an LZSS compressed copy of it, decoded by the driver while downloading.
+
+Stream format: a flag byte followed by up to 8 items, flag bit n (LSB first)
+tells whether item n is a literal byte (0) or a 2 byte back reference (1).
+A back reference holds distance - 1 in its low 10 bits (byte 0 and the two
+top bits of byte 1) and length - 3 in the low 6 bits of byte 1.
+"""
+
+import argparse
+import re
+import sys
+
+WINDOW_BITS = 10
+WINDOW_SIZE = 1 << WINDOW_BITS
+LEN_BITS = 16 - WINDOW_BITS
+MIN_MATCH = 3
+MAX_MATCH = (1 << LEN_BITS) - 1 + MIN_MATCH
+
+
+def read_image(path):
+    with open(path, encoding="utf-8") as f:
+        text = f.read()
+
+    match = re.search(r"tof_bin_image\s*\[\s*\]\s*=\s*\{(.*?)\}", text, re.S)
+    if match is None:
+        sys.exit(f"{path}: tof_bin_image[] not found")
+
+    return bytes(int(b, 16) for b in re.findall(r"0x([0-9A-Fa-f]{2})", match.group(1)))
+
+
+def compress(data):
+    out = bytearray()
+    chains = {}
+    pos = 0
+
+    while pos < len(data):
+        flag_idx = len(out)
+        out.append(0)
+
+        for bit in range(8):
+            if pos >= len(data):
+                break
+
+            best_len = 0
+            best_dist = 0
+            for cand in reversed(chains.get(data[pos:pos + MIN_MATCH], [])):
+                if pos - cand > WINDOW_SIZE:
+                    break
+                length = 0
+                while (length < MAX_MATCH and pos + length < len(data) and
+                       data[cand + length] == data[pos + length]):
+                    length += 1
+                if length > best_len:
+                    best_len = length
+                    best_dist = pos - cand
+
+            if best_len >= MIN_MATCH:
+                out[flag_idx] |= 1 << bit
+                out.append((best_dist - 1) & 0xFF)
+                out.append((((best_dist - 1) >> 8) << LEN_BITS) | (best_len - MIN_MATCH))
+                step = best_len
+            else:
+                out.append(data[pos])
+                step = 1
+
+            for i in range(pos, pos + step):
+                chains.setdefault(data[i:i + MIN_MATCH], []).append(i)
+            pos += step
+
+    return bytes(out)
+
+
+def decompress(data, size):
+    out = bytearray()
+    pos = 0
+
+    while len(out) < size:
+        flags = data[pos]
+        pos += 1
+        for bit in range(8):
+            if len(out) >= size:
+                break
+            if flags & (1 << bit):
+                dist = (data[pos] | ((data[pos + 1] >> LEN_BITS) << 8)) + 1
+                length = (data[pos + 1] & ((1 << LEN_BITS) - 1)) + MIN_MATCH
+                pos += 2
+                for _ in range(length):
+                    out.append(out[-dist])
+            else:
+                out.append(data[pos])
+                pos += 1
+
+    return bytes(out)
+
+
+def write_header(path, image, packed):
+    lines = []
+    for i in range(0, len(packed), 12):
+        lines.append("    " + " ".join(f"0x{b:02X}," for b in packed[i:i + 12]))
+
+    with open(path, "w", encoding="utf-8") as f:
+        f.write("/* Generated by compress_tof_image.py from tof_bin_image.h, do not edit. */\n\n")
+        f.write("#ifndef TOF_BIN_IMAGE_LZSS_H\n#define TOF_BIN_IMAGE_LZSS_H\n\n")
+        f.write("#include <stdint.h>\n\n")
+        f.write(f"#define TOF_BIN_IMAGE_SIZE              {len(image)}\n")
+        f.write(f"#define TOF_BIN_IMAGE_LZSS_WINDOW_BITS  {WINDOW_BITS}\n")
+        f.write(f"#define TOF_BIN_IMAGE_LZSS_MIN_MATCH    {MIN_MATCH}\n\n")
+        f.write("static const uint8_t tof_bin_image_lzss[] =\n{\n")
+        f.write("\n".join(lines))
+        f.write("\n};\n\n#endif // TOF_BIN_IMAGE_LZSS_H\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="tof_bin_image.h")
+    parser.add_argument("output", help="generated header")
+    args = parser.parse_args()
+
+    image = read_image(args.input)
+    packed = compress(image)
+
+    if decompress(packed, len(image)) != image:
+        sys.exit("LZSS round trip failed")
+
+    write_header(args.output, image, packed)
+
+
+if __name__ == "__main__":
+    main()
@@ -27,11 +27,15 @@
 
 #include <kernel.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
 #include <drivers/sensor.h>
+#include <pm/device_runtime.h>
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
 #include "lightranger9.h"
 #include "../bluetooth_brodcaster/bt_broadcaster.h"
+#include "../zone_filter/zone_filter.h"
 
 /* ----------------------------------------------------------------
  * APPLICATION CONFIGURATION
@@ -43,6 +47,72 @@
  */
 #define ENABLE_MEASUREMENT_DATA_PRINTING	1
 
+/**
+ * @brief Change this flag to 1 to measure in bursts. The sensor is held
+ * and keeps measuring while SENSOR_BURST_BROADCASTS broadcasts are sent,
+ * then it is released for SENSOR_IDLE_MS and the driver puts it in
+ * standby. Only used with CONFIG_PM_DEVICE_RUNTIME, the sensor measures
+ * all the time otherwise.
+ */
+#define ENABLE_SENSOR_BURSTS	0
+#define SENSOR_BURST_BROADCASTS	10
+#define SENSOR_IDLE_MS	60000
+
+/**
+ * @brief Change this flag to 1 to run the sensor factory calibration
+ * at startup when none is stored yet. Only used with
+ * CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION, see lightranger9_factory_calibrate()
+ * for the conditions the sensor must be calibrated in.
+ */
+#define ENABLE_FACTORY_CALIBRATION	0
+
+/**
+ * @brief Change this flag to 1 to broadcast every sub-capture as soon as
+ * it is read instead of complete measurements. The gateway updates its
+ * zone maps with each of them, which cuts the latency for moving objects
+ * to a single sub-capture (and a single advertising part) at the cost of
+ * more broadcasts.
+ */
+#define ENABLE_PARTIAL_FRAME_STREAMING	0
+
+/**
+ * @brief Change this flag to 1 to filter every zone over time before a
+ * complete measurement is broadcast, which steadies the distances of
+ * static objects. ZONE_FILTER_MODE selects the median of the last frames,
+ * which drops single frame outliers, or exponential smoothing with
+ * ZONE_FILTER_EMA_ALPHA (Q15) as weight of the new frame, which also
+ * evens out noise but lags behind moving objects. Sub-captures of
+ * ENABLE_PARTIAL_FRAME_STREAMING are never filtered.
+ * Add CONFIG_CMSIS_DSP=y and CONFIG_CMSIS_DSP_BASICMATH=y to prj.conf for
+ * the CMSIS-DSP smoothing kernels (plain C otherwise), and
+ * CONFIG_TIMING_FUNCTIONS=y to print the filter cycles of every frame.
+ */
+#define ENABLE_ZONE_FILTER	0
+#define ZONE_FILTER_MODE	ZONE_FILTER_MEDIAN
+#define ZONE_FILTER_EMA_ALPHA	0x2000
+
+/**
+ * @brief Change this flag to 1 to broadcast a complete measurement only
+ * when the depth map changed since the last broadcast one. A zone has
+ * changed when a target appeared in it, disappeared from it, or moved by
+ * more than CHANGE_ZONE_THRESHOLD_MM or CHANGE_ZONE_THRESHOLD_PERCENT of
+ * its distance, whichever is larger. The measurement is broadcast once
+ * CHANGE_MIN_ZONES zones of either object map changed, and at least every
+ * CHANGE_KEEP_ALIVE_MS so the gateway knows the sensor is still there.
+ * Not used with ENABLE_PARTIAL_FRAME_STREAMING.
+ */
+#define ENABLE_CHANGE_DRIVEN_BROADCASTING	0
+#define CHANGE_ZONE_THRESHOLD_MM	50
+#define CHANGE_ZONE_THRESHOLD_PERCENT	5
+#define CHANGE_MIN_ZONES	2
+#define CHANGE_KEEP_ALIVE_MS	30000
+
+/**
+ * @brief Time to wait before fetching again after the driver failed to
+ * recover from a sensor fault.
+ */
+#define FETCH_RETRY_DELAY_MS	1000
+
 /* ----------------------------------------------------------------
  * ZEPHYR RELATED DEFINITIONS/DECLARATIONS
  * -------------------------------------------------------------- */
@@ -60,12 +130,54 @@
  */
 static lightranger9_measurement_t bt_data;
 
+/**
+ * Sub-capture data, see ENABLE_PARTIAL_FRAME_STREAMING
+ */
+static lightranger9_partial_t bt_partial;
+
+#if 1 == ENABLE_CHANGE_DRIVEN_BROADCASTING
+/**
+ * Last broadcast measurement, see ENABLE_CHANGE_DRIVEN_BROADCASTING
+ */
+static lightranger9_measurement_t bt_sent;
+static int64_t bt_sent_ms;
+static bool bt_sent_valid;
+static uint32_t bt_suppressed;
+#endif
+
+/**
+ * Broadcast payload types, first byte of every payload
+ * Note: should be the same as the gateway (check Gateway main.c)
+ */
+#define BT_MSG_TYPE_MEASUREMENT     0x01
+#define BT_MSG_TYPE_PARTIAL         0x02
+
+/**
+ * Broadcast payload, the object maps cut down to the zones in use
+ */
+static uint8_t bt_payload[1 + sizeof(lightranger9_measurement_t)];
+
 /**
  * Simple ready flag.
  * Shows if data was parsed and is ready to be sent via BT.
  */
 bool ready_flag;
 
+#ifdef CONFIG_LIGHTRANGER9_TRIGGER
+/**
+ * Given by the sensor data ready trigger,
+ * main thread sleeps on it until a capture is ready.
+ */
+static K_SEM_DEFINE(capture_ready, 0, 1);
+#endif
+
+#if defined(CONFIG_PM_DEVICE_RUNTIME) && (1 == ENABLE_SENSOR_BURSTS)
+/**
+ * Broadcasts sent in the current burst, see ENABLE_SENSOR_BURSTS
+ */
+static uint32_t bt_burst_count;
+#endif
+
 /* ----------------------------------------------------------------
  * FUNCTION
  * -------------------------------------------------------------- */
@@ -79,11 +191,179 @@ bool ready_flag;
 void static print_measurement(lightranger9_measurement_t *measurement);
 #endif
 
+/**
+ * @brief Pack a measurement for broadcasting. Only the first
+ * measurement->zones entries of each object map are sent, so
+ * 4x4 and 3x3 frames need far fewer advertising parts.
+ * Note: the gateway unpacks it the same way (check Gateway main.c)
+ * 
+ * @param measurement  measurement data
+ * @param buf          destination, sizeof(bt_payload) bytes
+ * @return             payload length
+ */
+static uint16_t pack_measurement(lightranger9_measurement_t *measurement, uint8_t *buf)
+{
+    size_t header_len = offsetof(lightranger9_measurement_t, obj1);
+    size_t map_len = measurement->zones * sizeof(lightranger9_meas_result_t);
+
+    *buf++ = BT_MSG_TYPE_MEASUREMENT;
+    memcpy(buf, measurement, header_len);
+    memcpy(buf + header_len, measurement->obj1, map_len);
+    memcpy(buf + header_len + map_len, measurement->obj2, map_len);
+
+    return 1 + header_len + (2 * map_len);
+}
+
+#if 1 == ENABLE_CHANGE_DRIVEN_BROADCASTING
+/**
+ * @brief Check if a single zone changed
+ * 
+ * @param now   distance in the new measurement.
+ * @param sent  distance in the last broadcast measurement.
+ * @return      true if it changed by more than the zone threshold
+ */
+static bool zone_changed(uint16_t now, uint16_t sent)
+{
+    uint16_t threshold;
+    uint16_t delta;
+
+    if ((now == 0) || (sent == 0)) {
+        // target appeared or disappeared
+        return now != sent;
+    }
+
+    threshold = MAX(CHANGE_ZONE_THRESHOLD_MM,
+                    ((uint32_t)sent * CHANGE_ZONE_THRESHOLD_PERCENT) / 100);
+    delta = (now > sent) ? (now - sent) : (sent - now);
+
+    return delta > threshold;
+}
+
+/**
+ * @brief Check if a measurement has to be broadcast, i.e. if it differs
+ * from the last broadcast one or the keep-alive interval has passed.
+ * 
+ * @param measurement  measurement data
+ * @return             true if it should be broadcast
+ */
+static bool measurement_changed(lightranger9_measurement_t *measurement)
+{
+    uint8_t changed = 0;
+    uint8_t idx;
+
+    if (!bt_sent_valid || (measurement->zones != bt_sent.zones) ||
+        ((k_uptime_get() - bt_sent_ms) >= CHANGE_KEEP_ALIVE_MS)) {
+        return true;
+    }
+
+    for (idx = 0; (idx < measurement->zones) && (changed < CHANGE_MIN_ZONES); idx++) {
+        if (zone_changed(measurement->obj1[idx].distance_mm, bt_sent.obj1[idx].distance_mm)) {
+            changed++;
+        }
+        if (zone_changed(measurement->obj2[idx].distance_mm, bt_sent.obj2[idx].distance_mm)) {
+            changed++;
+        }
+    }
+
+    return changed >= CHANGE_MIN_ZONES;
+}
+#endif
+
+/**
+ * @brief Broadcast the packed payload
+ * 
+ * @param len  payload length.
+ */
+static void broadcast_payload(uint16_t len)
+{
+    bt_broadcaster_send_message(bt_payload, len);
+#if defined(CONFIG_PM_DEVICE_RUNTIME) && (1 == ENABLE_SENSOR_BURSTS)
+    bt_burst_count++;
+#endif
+}
+
+/**
+ * @brief Broadcast a complete measurement
+ * 
+ * @param measurement  measurement data
+ */
+static void broadcast_measurement(lightranger9_measurement_t *measurement)
+{
+#if 1 == ENABLE_ZONE_FILTER
+    zone_filter_apply(measurement);
+#endif
+#if 1 == ENABLE_CHANGE_DRIVEN_BROADCASTING
+    if (!measurement_changed(measurement)) {
+        bt_suppressed++;
+        printk("No change in the depth map, broadcast skipped (%u so far)\n", bt_suppressed);
+        return;
+    }
+    bt_sent = *measurement;
+    bt_sent_ms = k_uptime_get();
+    bt_sent_valid = true;
+#endif
+    printk("Got new sensor measurement! Broadcasting...\n");
+#if 1 == ENABLE_MEASUREMENT_DATA_PRINTING
+    print_measurement(measurement);
+#endif
+    broadcast_payload(pack_measurement(measurement, bt_payload));
+}
+
+/**
+ * @brief Broadcast the zones of a single sub-capture
+ * 
+ * @param partial  sub-capture data
+ */
+static void broadcast_partial(lightranger9_partial_t *partial)
+{
+    printk("Got sub-capture %d of measurement %d! Broadcasting...\n",
+           partial->sub_capture, partial->result_number);
+    bt_payload[0] = BT_MSG_TYPE_PARTIAL;
+    memcpy(&bt_payload[1], partial, sizeof(*partial));
+    broadcast_payload(1 + sizeof(*partial));
+}
+
+/**
+ * @brief Release the sensor for SENSOR_IDLE_MS once a whole burst was
+ * broadcast. It stays held in between, so it does not stop and restart
+ * measuring for every frame.
+ * 
+ * @param dev  sensor device.
+ */
+static void idle_after_burst(const struct device *dev)
+{
+#if defined(CONFIG_PM_DEVICE_RUNTIME) && (1 == ENABLE_SENSOR_BURSTS)
+    if (bt_burst_count < SENSOR_BURST_BROADCASTS) {
+        return;
+    }
+
+    bt_burst_count = 0;
+    printk("Burst done, sensor in standby for %d ms\n", SENSOR_IDLE_MS);
+    pm_device_runtime_put(dev);
+    k_msleep(SENSOR_IDLE_MS);
+    pm_device_runtime_get(dev);
+#else
+    ARG_UNUSED(dev);
+#endif
+}
+
+#ifdef CONFIG_LIGHTRANGER9_TRIGGER
+/**
+ * @brief Sensor data ready trigger handler
+ * 
+ * @param dev      sensor device.
+ * @param trigger  trigger which fired.
+ */
+static void capture_ready_handler(const struct device *dev, struct sensor_trigger *trigger)
+{
+    k_sem_give(&capture_ready);
+}
+#endif
+
 void main( void )
 {
     // Get sensor device
     const struct device *tmf  = DEVICE_DT_GET_ANY(mikroe_lightranger9);
-    lightranger9_meas_cpt_t sens_data = {0};
     int ret;
     ready_flag = false;
 
@@ -106,47 +386,122 @@ void main( void )
 
     ret = bt_broadcaster_create();
 
+#if 1 == ENABLE_ZONE_FILTER
+    ret = zone_filter_init(ZONE_FILTER_MODE, ZONE_FILTER_EMA_ALPHA);
+    if (ret) {
+        printk( "Could not set up zone filter error code (%d)", ret);
+    }
+#endif
+
+#if defined(CONFIG_LIGHTRANGER9_FACTORY_CALIBRATION) && (1 == ENABLE_FACTORY_CALIBRATION)
+    if (!lightranger9_is_calibrated(tmf)) {
+        printk("Running factory calibration, keep the field of view clear...\n");
+        ret = lightranger9_factory_calibrate(tmf);
+        if (ret) {
+            printk( "Factory calibration failed error code (%d)", ret);
+        }
+    }
+#endif
+
+#ifdef CONFIG_LIGHTRANGER9_TRIGGER
+    struct sensor_trigger trig = {
+        .type = SENSOR_TRIG_DATA_READY,
+        .chan = SENSOR_CHAN_ALL,
+    };
+
+    ret = sensor_trigger_set(tmf, &trig, capture_ready_handler);
+    if (ret) {
+        printk( "Could not set sensor trigger error code (%d)", ret);
+        return;
+    }
+#endif
+
+#ifdef CONFIG_PM_DEVICE_RUNTIME
+    /**
+     * The driver keeps the sensor in standby until it is needed,
+     * hold it for as long as measurements are streamed.
+     */
+    ret = pm_device_runtime_get(tmf);
+    if (ret) {
+        printk( "Could not wake up sensor error code (%d)", ret);
+        return;
+    }
+#endif
+
     printk("Waiting for sensor measurements...\n");
 
     /**
      * Get sensor measurements
      */
     while ( true ) {
+#ifdef CONFIG_LIGHTRANGER9_TRIGGER
+        /**
+         * Sleep until the driver signals that a capture is ready.
+         */
+        k_sem_take(&capture_ready, K_FOREVER);
+
+        /**
+         * Broadcasting a measurement takes seconds, meanwhile the driver
+         * queues the next captures. Drain all of them, each completed
+         * measurement is broadcast in turn.
+         */
+#if 1 == ENABLE_PARTIAL_FRAME_STREAMING
+        while (sensor_sample_fetch(tmf) == 0) {
+            if (lightranger9_decode_partial(tmf, &bt_partial)) {
+                broadcast_partial(&bt_partial);
+            }
+        }
+#else
+        while (lightranger9_fifo_drain(tmf, &bt_data, NULL)) {
+            broadcast_measurement(&bt_data);
+        }
+#endif
+        idle_after_burst(tmf);
+#else
         /**
          * Wait for interrupt to go down.
          * Then a capture is ready.
          */
         while (lightranger9_get_interrupt_pin(tmf));
 
-        if ( sensor_sample_fetch( tmf ) ) {
-            printk( "Failed to fetch sample from LightRanger9!" );
-            return;
+        ret = sensor_sample_fetch( tmf );
+        if (ret == -EAGAIN) {
+            /**
+             * The driver recovered from a bus or sensor fault,
+             * the next capture follows the restarted measurement.
+             */
+            continue;
+        } else if (ret) {
+            printk( "Failed to fetch sample from LightRanger9 error code (%d)\n", ret );
+            k_msleep(FETCH_RETRY_DELAY_MS);
+            continue;
         }
 
         /**
-         * Copy sensor data to local structure
+         * Decode the capture into its zones of the measurement.
          * Usually the way this is done on Zephyr drivers is by 
          * calling lightranger9_channel_get() with the appropriate sensor enum which
          * returns a sensor_value type struct, containing the integer and decimal value
          * Due to the nature of the data from the ToF sensor (measurements are stored on an array)
-         * we get the data from an indirect manner
+         * the driver writes them into the measurement directly.
          */
-        lightranger9_get_measurements(tmf, &sens_data);
-        ready_flag =  lightranger9_parse_measurement(&sens_data, &bt_data);
-        memset(&sens_data, 0, sizeof(sens_data));
+#if 1 == ENABLE_PARTIAL_FRAME_STREAMING
+        if (lightranger9_decode_partial(tmf, &bt_partial)) {
+            broadcast_partial(&bt_partial);
+        }
+#else
+        ready_flag = lightranger9_decode_frame(tmf, &bt_data);
 
         /**
          * Broadcast a parsed measurement
          */
         if (ready_flag) {
-            printk("Got new sensor measurement! Broadcasting...\n");
-#if 1 == ENABLE_MEASUREMENT_DATA_PRINTING
-            print_measurement(&bt_data);
-#endif
-            bt_broadcaster_send_message((uint8_t*)(&bt_data), sizeof(bt_data));
-            memset(&bt_data, 0, sizeof(bt_data));
+            broadcast_measurement(&bt_data);
             ready_flag = false;
         }
+#endif
+        idle_after_burst(tmf);
+#endif
     }
 }
 
@@ -155,6 +510,7 @@ void main( void )
 void static print_measurement(lightranger9_measurement_t *measurement)
 {
     uint8_t idx;
+    uint8_t cols = (measurement->zones == 9) ? 3 : ((measurement->zones == 16) ? 4 : 8);
 
     printk("Result number: %d\n", measurement->result_number);
     printk("Die temperature: %d\n", measurement->temperature);
@@ -163,18 +519,26 @@ void static print_measurement(lightranger9_measurement_t *measurement)
     printk("Photon count: %d\n", measurement->photon_count);
     printk("Reference count: %d\n", measurement->reference_count);
     printk("Systick: %.2f\n", measurement->sys_tick_sec);
+    printk("Kilo iterations: %d\n", measurement->kilo_iterations);
+#if (1 == ENABLE_ZONE_FILTER) && defined(CONFIG_TIMING_FUNCTIONS)
+    zone_filter_stats_t filter_stats;
+
+    zone_filter_get_stats(&filter_stats);
+    printk("Zone filter: %u cycles (%u ns), max %u cycles\n",
+           filter_stats.last_cycles, filter_stats.last_ns, filter_stats.max_cycles);
+#endif
 
     printk("\nObject Map 1");
-    for (idx = 0; idx < LIGHTRANGER9_OBJECT_MAP_SIZE; idx ++) {
-        if ((idx % 8) == 0) {
+    for (idx = 0; idx < measurement->zones; idx ++) {
+        if ((idx % cols) == 0) {
             printk("\n");
         }
         printk("%8d", measurement->obj1[idx].distance_mm);
     }
 
     printk("\n\nObject Map 2");
-    for (idx = 0; idx < LIGHTRANGER9_OBJECT_MAP_SIZE; idx ++) {
-        if ((idx % 8) == 0) {
+    for (idx = 0; idx < measurement->zones; idx ++) {
+        if ((idx % cols) == 0) {
             printk("\n");
         }
         printk("%8d", measurement->obj2[idx].distance_mm);
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2023 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief Checks the precomputed 8x8 zone map of
+ * lightranger9_parse_measurement() against the row/col arithmetic it
+ * replaced, and times both.
+ */
+
+#include <ztest.h>
+#include <device.h>
+#include <string.h>
+#include <timing/timing.h>
+#include "lightranger9.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+
+/**
+ * Frames parsed by each path of the benchmark
+ */
+#define BENCH_FRAMES            1000
+
+#define SUB_CAPTURES            (LIGHTRANGER9_SUBCAPTURE_3 + 1)
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+static lightranger9_meas_cpt_t captures[SUB_CAPTURES];
+static lightranger9_measurement_t table_meas;
+static lightranger9_measurement_t baseline_meas;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/**
+ * @brief The zone mapping of lightranger9_parse_measurement() before the
+ * table, kept verbatim as the reference.
+ */
+static void baseline_parse(const lightranger9_meas_cpt_t *capture,
+                           lightranger9_measurement_t *parsed_data)
+{
+    uint8_t result_cnt = 0, row = 0, col = 0;
+
+    for (result_cnt = 0; result_cnt < LIGHTRANGER9_MAX_MEAS_RESULTS; result_cnt++) {
+        if (8 == (result_cnt % 9)) {
+            continue;
+        }
+        row = (((result_cnt % 9) / 2) * 2) + (capture->sub_capture / 2);
+        col = (((result_cnt % 9) % 2) * 4) + ((result_cnt % 18) / 9) + ((capture->sub_capture % 2) * 2);
+        if (result_cnt >= ( LIGHTRANGER9_MAX_MEAS_RESULTS / 2)) {
+            parsed_data->obj2[(row * 8) + col].distance_mm = capture->result[result_cnt].distance_mm;
+            parsed_data->obj2[(row * 8) + col].confidence  = capture->result[result_cnt].confidence;
+        } else {
+            parsed_data->obj1[(row * 8) + col].distance_mm = capture->result[result_cnt].distance_mm;
+            parsed_data->obj1[(row * 8) + col].confidence  = capture->result[result_cnt].confidence;
+        }
+    }
+}
+
+/**
+ * @brief Fills the sub-captures of one frame, every result of every
+ * sub-capture with its own distance so a misplaced one is caught.
+ */
+static void fill_captures(void)
+{
+    uint8_t sc;
+    uint8_t r;
+
+    memset(captures, 0, sizeof(captures));
+    for (sc = 0; sc < SUB_CAPTURES; sc++) {
+        captures[sc].sub_capture = sc;
+        captures[sc].reference_count = 1;
+        for (r = 0; r < LIGHTRANGER9_MAX_MEAS_RESULTS; r++) {
+            captures[sc].result[r].distance_mm = 1 + (sc * LIGHTRANGER9_MAX_MEAS_RESULTS) + r;
+            captures[sc].result[r].confidence  = 100 + r;
+        }
+    }
+}
+
+static const struct device *get_sensor(void)
+{
+    const struct device *dev = DEVICE_DT_GET_ANY(mikroe_lightranger9);
+
+    zassert_not_null(dev, "No LightRanger9 in the device tree");
+    zassert_true(device_is_ready(dev), "LightRanger9 not ready");
+
+    return dev;
+}
+
+/* ----------------------------------------------------------------
+ * TESTS
+ * -------------------------------------------------------------- */
+
+static void test_table_matches_arithmetic(void)
+{
+    const struct device *dev = get_sensor();
+    bool done;
+    uint8_t sc;
+    uint8_t i;
+
+    fill_captures();
+    memset(&table_meas, 0, sizeof(table_meas));
+    memset(&baseline_meas, 0, sizeof(baseline_meas));
+
+    for (sc = 0; sc < SUB_CAPTURES; sc++) {
+        done = lightranger9_parse_measurement(dev, &captures[sc], &table_meas);
+        zassert_equal(done, sc == LIGHTRANGER9_SUBCAPTURE_3,
+                      "Frame completed after sub-capture %d", sc);
+        baseline_parse(&captures[sc], &baseline_meas);
+    }
+
+    for (i = 0; i < LIGHTRANGER9_OBJECT_MAP_SIZE; i++) {
+        // every zone is written exactly by one result of one sub-capture
+        zassert_not_equal(baseline_meas.obj1[i].distance_mm, 0, "obj1 zone %d not mapped", i);
+        zassert_not_equal(baseline_meas.obj2[i].distance_mm, 0, "obj2 zone %d not mapped", i);
+
+        zassert_equal(table_meas.obj1[i].distance_mm, baseline_meas.obj1[i].distance_mm,
+                      "obj1 zone %d distance", i);
+        zassert_equal(table_meas.obj1[i].confidence, baseline_meas.obj1[i].confidence,
+                      "obj1 zone %d confidence", i);
+        zassert_equal(table_meas.obj2[i].distance_mm, baseline_meas.obj2[i].distance_mm,
+                      "obj2 zone %d distance", i);
+        zassert_equal(table_meas.obj2[i].confidence, baseline_meas.obj2[i].confidence,
+                      "obj2 zone %d confidence", i);
+    }
+}
+
+static void test_benchmark(void)
+{
+    const struct device *dev = get_sensor();
+    timing_t start;
+    timing_t end;
+    uint64_t table_cycles;
+    uint64_t baseline_cycles;
+    uint32_t frame;
+    uint8_t sc;
+
+    fill_captures();
+    timing_init();
+    timing_start();
+
+    /**
+     * The table path runs through lightranger9_parse_measurement(), so it
+     * also pays for the frame assembly the arithmetic did not have.
+     */
+    start = timing_counter_get();
+    for (frame = 0; frame < BENCH_FRAMES; frame++) {
+        for (sc = 0; sc < SUB_CAPTURES; sc++) {
+            lightranger9_parse_measurement(dev, &captures[sc], &table_meas);
+        }
+    }
+    end = timing_counter_get();
+    table_cycles = timing_cycles_get(&start, &end);
+
+    start = timing_counter_get();
+    for (frame = 0; frame < BENCH_FRAMES; frame++) {
+        for (sc = 0; sc < SUB_CAPTURES; sc++) {
+            baseline_parse(&captures[sc], &baseline_meas);
+        }
+    }
+    end = timing_counter_get();
+    baseline_cycles = timing_cycles_get(&start, &end);
+
+    timing_stop();
+
+    TC_PRINT("Sub-capture mapping, %d sub-captures each:\n", BENCH_FRAMES * SUB_CAPTURES);
+    TC_PRINT("  table:      %llu cycles (%llu ns)\n",
+             (unsigned long long)table_cycles,
+             (unsigned long long)timing_cycles_to_ns(table_cycles));
+    TC_PRINT("  arithmetic: %llu cycles (%llu ns)\n",
+             (unsigned long long)baseline_cycles,
+             (unsigned long long)timing_cycles_to_ns(baseline_cycles));
+}
+
+void test_main(void)
+{
+    ztest_test_suite(lightranger9_zone_map,
+                     ztest_unit_test(test_table_matches_arithmetic),
+                     ztest_unit_test(test_benchmark));
+    ztest_run_test_suite(lightranger9_zone_map);
+}
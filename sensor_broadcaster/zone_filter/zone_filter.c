@@ -0,0 +1,266 @@
+/*
+ * Copyright 2023 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <kernel.h>
+#include <string.h>
+#include <logging/log.h>
+#ifdef CONFIG_CMSIS_DSP
+#include <arm_math.h>
+#else
+typedef int16_t q15_t;
+#endif
+#ifdef CONFIG_TIMING_FUNCTIONS
+#include <timing/timing.h>
+#endif
+#include "zone_filter.h"
+
+LOG_MODULE_REGISTER(ZONE_FILTER, CONFIG_UART_CONSOLE_LOG_LEVEL);
+
+/**
+ * Both object maps, obj1 zones first then obj2 zones
+ */
+#define ZONE_FILTER_VALUES      (2 * LIGHTRANGER9_OBJECT_MAP_SIZE)
+
+/**
+ * Compare-exchange network sorting the median taps in ascending order
+ */
+#if 3 == ZONE_FILTER_MEDIAN_TAPS
+static const uint8_t zone_filter_network[][2] = {
+    {0, 1}, {1, 2}, {0, 1}
+};
+#elif 5 == ZONE_FILTER_MEDIAN_TAPS
+static const uint8_t zone_filter_network[][2] = {
+    {0, 1}, {3, 4}, {2, 4}, {2, 3}, {0, 3}, {0, 2}, {1, 4}, {1, 3}, {1, 2}
+};
+#else
+#error "ZONE_FILTER_MEDIAN_TAPS must be 3 or 5"
+#endif
+
+/**
+ * Filter state. Distances are kept as q15_t, which covers the 0 to
+ * 32767 mm range, so two zones fill one 32 bit SIMD word.
+ */
+static struct {
+    zone_filter_mode_t mode;
+    q15_t alpha;
+    uint8_t zones;
+    uint8_t head;
+    bool primed;
+    q15_t in[ZONE_FILTER_VALUES] __aligned(4);
+    q15_t work[ZONE_FILTER_VALUES] __aligned(4);
+    q15_t state[ZONE_FILTER_VALUES] __aligned(4);
+    q15_t history[ZONE_FILTER_MEDIAN_TAPS][ZONE_FILTER_VALUES] __aligned(4);
+    zone_filter_stats_t stats;
+} zf;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/**
+ * @brief Orders two zones in each of a and b at once, a gets the
+ * smaller and b the larger distance of each zone.
+ */
+static inline void zone_filter_cmp_exchange(uint32_t *a, uint32_t *b)
+{
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+    uint32_t lo;
+    uint32_t hi;
+
+    /**
+     * SSUB16 sets a GE flag per halfword where a >= b, SEL then picks
+     * per halfword. Kept in one asm block so the flags cannot be
+     * clobbered in between.
+     */
+    __asm__ ("ssub16 %0, %2, %3\n\t"
+             "sel    %0, %3, %2\n\t"
+             "sel    %1, %2, %3"
+             : "=&r" (lo), "=&r" (hi)
+             : "r" (*a), "r" (*b)
+             : "cc");
+    *a = lo;
+    *b = hi;
+#else
+    int16_t a0 = (int16_t)(*a & 0xFFFF), a1 = (int16_t)(*a >> 16);
+    int16_t b0 = (int16_t)(*b & 0xFFFF), b1 = (int16_t)(*b >> 16);
+
+    *a = (uint16_t)MIN(a0, b0) | ((uint32_t)(uint16_t)MIN(a1, b1) << 16);
+    *b = (uint16_t)MAX(a0, b0) | ((uint32_t)(uint16_t)MAX(a1, b1) << 16);
+#endif
+}
+
+static void zone_filter_median(q15_t *values, uint16_t count)
+{
+    uint32_t taps[ZONE_FILTER_MEDIAN_TAPS];
+    uint8_t valid[2];
+    uint16_t i;
+    uint8_t t;
+    uint8_t c;
+    uint8_t l;
+
+    memcpy(zf.history[zf.head], values, count * sizeof(q15_t));
+    zf.head = (zf.head + 1) % ZONE_FILTER_MEDIAN_TAPS;
+
+    if (!zf.primed) {
+        // no history yet, the first frame stands in for the missing ones
+        for (t = 0; t < ZONE_FILTER_MEDIAN_TAPS; t++) {
+            memcpy(zf.history[t], values, count * sizeof(q15_t));
+        }
+        zf.primed = true;
+    }
+
+    // count is even, both maps have the same number of zones
+    for (i = 0; i < count; i += 2) {
+        valid[0] = 0;
+        valid[1] = 0;
+        for (t = 0; t < ZONE_FILTER_MEDIAN_TAPS; t++) {
+            memcpy(&taps[t], &zf.history[t][i], sizeof(uint32_t));
+            valid[0] += (zf.history[t][i] != 0) ? 1 : 0;
+            valid[1] += (zf.history[t][i + 1] != 0) ? 1 : 0;
+        }
+        for (c = 0; c < ARRAY_SIZE(zone_filter_network); c++) {
+            zone_filter_cmp_exchange(&taps[zone_filter_network[c][0]],
+                                     &taps[zone_filter_network[c][1]]);
+        }
+
+        /**
+         * Frames without a target in the zone (0) sort first and are left
+         * out, the median is taken over the valid ones above them (the
+         * lower one of two). A zone without a target now stays 0.
+         */
+        for (l = 0; l < 2; l++) {
+            if (values[i + l] != 0) {
+                t = (ZONE_FILTER_MEDIAN_TAPS - valid[l]) + ((valid[l] - 1) / 2);
+                memcpy(&values[i + l], (uint8_t *)&taps[t] + (l * sizeof(q15_t)), sizeof(q15_t));
+            } else {
+                // do nothing
+            }
+        }
+    }
+}
+
+static void zone_filter_ema(q15_t *values, uint16_t count)
+{
+    uint16_t i;
+
+    if (!zf.primed) {
+        memcpy(zf.state, values, count * sizeof(q15_t));
+        zf.primed = true;
+        return;
+    }
+
+    // y += alpha * (x - y), saturating and two zones per instruction
+#ifdef CONFIG_CMSIS_DSP
+    arm_sub_q15(values, zf.state, zf.work, count);
+    arm_scale_q15(zf.work, zf.alpha, 0, zf.work, count);
+    arm_add_q15(zf.state, zf.work, zf.work, count);
+#else
+    // distances are never negative, so none of the steps saturate
+    for (i = 0; i < count; i++) {
+        zf.work[i] = zf.state[i] + (q15_t)(((int32_t)(values[i] - zf.state[i]) * zf.alpha) >> 15);
+    }
+#endif
+
+    for (i = 0; i < count; i++) {
+        if (values[i] == 0) {
+            // no target, keep the state for when it comes back
+        } else if (zf.state[i] == 0) {
+            // new target, do not ramp up from 0
+            zf.state[i] = values[i];
+        } else {
+            zf.state[i] = zf.work[i];
+            values[i] = zf.work[i];
+        }
+    }
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+int zone_filter_init(zone_filter_mode_t mode, int16_t alpha)
+{
+    if ((mode > ZONE_FILTER_EMA) || ((mode == ZONE_FILTER_EMA) && (alpha <= 0))) {
+        return -EINVAL;
+    }
+
+    memset(&zf, 0, sizeof(zf));
+    zf.mode = mode;
+    zf.alpha = alpha;
+
+#ifdef CONFIG_TIMING_FUNCTIONS
+    timing_init();
+    timing_start();
+#endif
+
+    return 0;
+}
+
+void zone_filter_apply(lightranger9_measurement_t *measurement)
+{
+    uint8_t zones = MIN(measurement->zones, LIGHTRANGER9_OBJECT_MAP_SIZE);
+    uint16_t count = 2 * zones;
+    uint8_t i;
+#ifdef CONFIG_TIMING_FUNCTIONS
+    timing_t start = timing_counter_get();
+    timing_t end;
+    uint64_t cycles;
+#endif
+
+    if (zf.mode == ZONE_FILTER_NONE) {
+        return;
+    }
+
+    if (zones != zf.zones) {
+        // other zone mode, the history no longer matches
+        zf.zones = zones;
+        zf.primed = false;
+        zf.head = 0;
+    } else {
+        // do nothing
+    }
+
+    for (i = 0; i < zones; i++) {
+        zf.in[i]         = (q15_t)MIN(measurement->obj1[i].distance_mm, INT16_MAX);
+        zf.in[zones + i] = (q15_t)MIN(measurement->obj2[i].distance_mm, INT16_MAX);
+    }
+
+    if (zf.mode == ZONE_FILTER_MEDIAN) {
+        zone_filter_median(zf.in, count);
+    } else {
+        zone_filter_ema(zf.in, count);
+    }
+
+    for (i = 0; i < zones; i++) {
+        measurement->obj1[i].distance_mm = (uint16_t)zf.in[i];
+        measurement->obj2[i].distance_mm = (uint16_t)zf.in[zones + i];
+    }
+
+#ifdef CONFIG_TIMING_FUNCTIONS
+    end = timing_counter_get();
+    cycles = timing_cycles_get(&start, &end);
+    zf.stats.frames++;
+    zf.stats.last_cycles = (uint32_t)cycles;
+    zf.stats.max_cycles = MAX(zf.stats.max_cycles, zf.stats.last_cycles);
+    zf.stats.total_cycles += cycles;
+    zf.stats.last_ns = (uint32_t)timing_cycles_to_ns(cycles);
+#endif
+}
+
+void zone_filter_get_stats(zone_filter_stats_t *stats)
+{
+    *stats = zf.stats;
+}
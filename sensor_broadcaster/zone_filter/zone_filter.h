@@ -0,0 +1,84 @@
+/*
+ * Copyright 2023 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZONE_FILTER_ZONE_FILTER_H_
+#define ZONE_FILTER_ZONE_FILTER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lightranger9.h"
+
+/**
+ * Number of frames the median filter looks at, 3 or 5
+ */
+#define ZONE_FILTER_MEDIAN_TAPS     3
+
+/**
+ * @brief Temporal filter applied to every zone
+ */
+typedef enum {
+    ZONE_FILTER_NONE = 0,
+    ZONE_FILTER_MEDIAN,     /* median of the last ZONE_FILTER_MEDIAN_TAPS frames */
+    ZONE_FILTER_EMA         /* exponential smoothing */
+} zone_filter_mode_t;
+
+/**
+ * @brief Filter cost, in cycles of the timing API per frame
+ * (all 0 without CONFIG_TIMING_FUNCTIONS)
+ */
+typedef struct zone_filter_stats_type {
+    uint32_t frames;
+    uint32_t last_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+    uint32_t last_ns;
+} zone_filter_stats_t;
+
+/**
+ * @brief Selects the filter and clears its history
+ *
+ * @param mode   filter to apply.
+ * @param alpha  weight of the new frame for ZONE_FILTER_EMA, Q15
+ *               (e.g. 0x2000 = 0.25), ignored by the other filters.
+ * @return       0 on success else negative error on failure
+ */
+int zone_filter_init(zone_filter_mode_t mode, int16_t alpha);
+
+/**
+ * @brief Filters the distances of both object maps of a complete
+ * measurement in place, confidences are left untouched. Zones below the
+ * confidence threshold (distance 0) stay 0 and do not count as a sample
+ * in later frames. The history starts over when the number of zones
+ * changes.
+ *
+ * @param measurement  measurement to filter
+ */
+void zone_filter_apply(lightranger9_measurement_t *measurement);
+
+/**
+ * @brief Gets the filter cost per frame
+ *
+ * @param stats  statistics to fill
+ */
+void zone_filter_get_stats(zone_filter_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZONE_FILTER_ZONE_FILTER_H_ */